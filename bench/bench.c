@@ -0,0 +1,647 @@
+/** @file bench.c
+ *  @brief Headless benchmarks for inline.
+ *
+ *  The editor is compiled into this file so that its internals can be driven without a terminal:
+ *  keypresses are read from an in-memory script and frames are written to a counting sink in place
+ *  of stdin and stdout. Each scenario reports the time, output bytes and allocations per operation.
+ *
+ *  Usage: inline_bench [filter] - runs the scenarios whose names contain filter, or all of them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+
+static int bench_read(int fd, void *buf, size_t n);
+static int bench_write(int fd, const void *buf, size_t n);
+
+#define INLINE_READ(fd, buf, n) bench_read(fd, buf, n)
+#define INLINE_WRITE(fd, buf, n) bench_write(fd, buf, n)
+
+#include "inline.c"
+
+#define BENCH_REPEATS 3         // Each scenario is run this many times and the fastest run reported
+#define BENCH_COLUMNS 80        // Size of the simulated terminal
+#define BENCH_ROWS 24
+
+#define BENCH_KEYSTROKES 1000   // Characters typed by the typing scenarios
+#define BENCH_HISTORY 100000    // Entries in the history scenarios
+#define BENCH_CANDIDATES 100000 // Candidates offered by the completion scenarios
+
+/* **********************************************************************
+ * Input and output sinks
+ * ********************************************************************** */
+
+/** Scripted terminal input; each event is delivered by its own sequence of reads, as a terminal would */
+typedef struct {
+    char *bytes;        // Concatenated events
+    size_t len;         // Length of bytes
+    size_t size;        // Allocated length of bytes
+    size_t *ends;       // Offset at which each event ends
+    int count;          // Number of events
+    int capacity;       // Allocated length of ends
+    int next;           // Event being read
+    size_t pos;         // Offset of the next byte to read
+} bench_script_t;
+
+static bench_script_t bench_input;
+
+/** Output counters */
+typedef struct {
+    size_t bytes;       // Bytes written
+    size_t writes;      // Write calls made
+} bench_output_t;
+
+static bench_output_t bench_output;
+
+/** Allocation counters */
+typedef struct {
+    size_t allocs;      // Calls to the allocator
+    size_t reallocs;    // Calls to the reallocator
+    size_t frees;       // Calls to the deallocator
+} bench_allocs_t;
+
+static bench_allocs_t bench_allocs;
+
+/** Abandon the benchmark if memory for the script runs out */
+static void *bench_checked(void *ptr) {
+    if (!ptr) {
+        fprintf(stderr, "inline_bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+/** Discard the script */
+static void bench_clearscript(void) {
+    bench_input.len = 0;
+    bench_input.count = 0;
+    bench_input.next = 0;
+    bench_input.pos = 0;
+}
+
+/** Append an event to the script */
+static void bench_event(const char *bytes, size_t len) {
+    if (bench_input.len + len > bench_input.size) {
+        size_t size = (bench_input.size ? bench_input.size : 1024);
+        while (size < bench_input.len + len) size *= 2;
+        bench_input.bytes = bench_checked(realloc(bench_input.bytes, size));
+        bench_input.size = size;
+    }
+    if (bench_input.count >= bench_input.capacity) {
+        int capacity = (bench_input.capacity ? 2 * bench_input.capacity : 256);
+        bench_input.ends = bench_checked(realloc(bench_input.ends, sizeof(size_t) * (size_t) capacity));
+        bench_input.capacity = capacity;
+    }
+
+    memcpy(bench_input.bytes + bench_input.len, bytes, len);
+    bench_input.len += len;
+    bench_input.ends[bench_input.count++] = bench_input.len;
+}
+
+/** Append an event given as a string */
+static void bench_key(const char *seq) {
+    bench_event(seq, strlen(seq));
+}
+
+/** Append an event for each character of a string, as if typed */
+static void bench_type(const char *text) {
+    for (const char *p = text; *p; p++) bench_event(p, 1);
+}
+
+/** Read from the script in place of stdin; returns 0 once it is exhausted */
+static int bench_read(int fd, void *buf, size_t n) {
+    (void) fd;
+    if (bench_input.next >= bench_input.count) return 0;
+
+    size_t end = bench_input.ends[bench_input.next], chunk = end - bench_input.pos;
+    if (chunk > n) chunk = n;
+    memcpy(buf, bench_input.bytes + bench_input.pos, chunk);
+    bench_input.pos += chunk;
+    if (bench_input.pos == end) bench_input.next++;
+    return (int) chunk;
+}
+
+/** Count output in place of stdout */
+static int bench_write(int fd, const void *buf, size_t n) {
+    (void) fd; (void) buf;
+    bench_output.bytes += n;
+    bench_output.writes++;
+    return (int) n;
+}
+
+static void *bench_alloc(size_t size, void *ref) {
+    (void) ref;
+    bench_allocs.allocs++;
+    return malloc(size);
+}
+
+static void *bench_realloc(void *ptr, size_t size, void *ref) {
+    (void) ref;
+    bench_allocs.reallocs++;
+    return realloc(ptr, size);
+}
+
+static void bench_free(void *ptr, void *ref) {
+    (void) ref;
+    bench_allocs.frees++;
+    free(ptr);
+}
+
+/* **********************************************************************
+ * Headless editing sessions
+ * ********************************************************************** */
+
+static uint64_t bench_start_ns;
+
+/** Monotonic clock in nanoseconds */
+static uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/** Begin the timed part of a scenario, resetting the counters */
+static void bench_start(void) {
+    memset(&bench_output, 0, sizeof(bench_output));
+    memset(&bench_allocs, 0, sizeof(bench_allocs));
+    bench_start_ns = bench_now();
+}
+
+/** Show the editing window on a simulated terminal, as inline_readline would but without raw mode */
+static void bench_begin(inline_editor *edit) {
+    inline_reset(edit);
+    edit->ncols = BENCH_COLUMNS;
+    edit->nrows = BENCH_ROWS;
+    inline_initviewport(edit);
+    inline_redraw(edit);
+}
+
+/** Insert text (untimed setup), leaving the cursor after it */
+static void bench_load(inline_editor *edit, const char *text, size_t len) {
+    if (!inline_insert(edit, text, len)) {
+        fprintf(stderr, "inline_bench: could not load %zu bytes\n", len);
+        exit(EXIT_FAILURE);
+    }
+    inline_redraw(edit);
+    edit->refresh = false;
+}
+
+/** Process the script, redrawing once each event has been consumed as inline_readline would */
+static void bench_play(inline_editor *edit) {
+    keypress_t key;
+    while (inline_readkeypress(edit, &key) && inline_processkeypress(edit, &key)) {
+        if (edit->refresh && edit->input_pos >= edit->input_len) {
+            inline_redraw(edit);
+            edit->refresh = false;
+        }
+    }
+}
+
+/* ----------------------------------------
+ * Corpora
+ * ---------------------------------------- */
+
+static const char *bench_ascii = "The quick brown fox jumps over the lazy dog; ";
+static const char *bench_cjk = "\xe6\xbc\xa2\xe5\xad\x97\xe4\xbb\xae\xe5\x90\x8d\xe4\xba\xa4\xe3\x81\x98\xe3\x82\x8a\xe6\x96\x87\xe3\x80\x81"; // 漢字仮名交じり文、
+static const char *bench_emoji =
+    "\xf0\x9f\x91\xa8\xe2\x80\x8d\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa7\xe2\x80\x8d\xf0\x9f\x91\xa6" // Family (ZWJ sequence)
+    "\xf0\x9f\x8f\xb3\xef\xb8\x8f\xe2\x80\x8d\xf0\x9f\x8c\x88"                                         // Rainbow flag
+    "\xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd"                                                                 // Thumbs up, skin tone
+    "\xf0\x9f\x87\xac\xf0\x9f\x87\xa7 ";                                                               // Flag (regional indicators)
+
+/** Build a corpus of at least len bytes by repeating a unit, breaking lines every `line` bytes or so (0 for none) */
+static char *bench_corpus(const char *unit, size_t len, size_t line, size_t *out_len) {
+    size_t ulen = strlen(unit), n = 0, col = 0;
+    char *text = bench_checked(malloc(len + ulen + 2));
+    while (n < len) {
+        if (line && col >= line) {
+            text[n++] = '\n';
+            col = 0;
+        }
+        memcpy(text + n, unit, ulen);
+        n += ulen;
+        col += ulen;
+    }
+    text[n] = '\0';
+    *out_len = n;
+    return text;
+}
+
+/* ----------------------------------------
+ * Syntax highlighter from examples/calc
+ * ---------------------------------------- */
+
+enum {
+    P_DEFAULT = 0,
+    P_NUMBER,
+    P_OPERATOR,
+    P_PAREN,
+    P_FUNCTION,
+    P_IDENTIFIER,
+};
+
+static const int bench_palette[] = {
+    [P_DEFAULT]    = -1,
+    [P_NUMBER]     = INLINE_COLOR_ANSI216(1, 4, 2),
+    [P_OPERATOR]   = INLINE_COLOR_ANSI216(5, 3, 1),
+    [P_PAREN]      = INLINE_COLOR_ANSI216(2, 3, 5),
+    [P_FUNCTION]   = INLINE_COLOR_ANSI216(4, 2, 5),
+    [P_IDENTIFIER] = INLINE_COLOR_ANSI216(5, 1, 1),
+};
+
+static int bench_classifyidentifier(const char *s, size_t len) {
+    if (len == 3 && strncmp(s, "sin", 3) == 0) return P_FUNCTION;
+    if (len == 3 && strncmp(s, "cos", 3) == 0) return P_FUNCTION;
+    if (len == 3 && strncmp(s, "tan", 3) == 0) return P_FUNCTION;
+    if (len == 2 && strncmp(s, "pi", 2) == 0)  return P_FUNCTION;
+    if (len == 1 && strncmp(s, "e", 1) == 0)   return P_FUNCTION;
+    if (len == 4 && strncmp(s, "quit", 4) == 0) return P_FUNCTION;
+    if (len == 4 && strncmp(s, "help", 4) == 0) return P_FUNCTION;
+    return P_IDENTIFIER;
+}
+
+static bool bench_syntaxcolor(const char *utf8, void *ref, size_t offset, inline_colorspan_t *out) {
+    (void) ref;
+
+    const size_t n = strlen(utf8);
+    if (offset >= n) return false;
+
+    unsigned char c = (unsigned char) utf8[offset];
+    if (isspace(c)) { // Whitespace
+        size_t i = offset + 1;
+        while (i < n && isspace((unsigned char) utf8[i])) i++;
+        out->byte_end = i;
+        out->color = P_DEFAULT;
+        return true;
+    }
+
+    if (c == '(' || c == ')') { // Parentheses
+        out->byte_end = offset + 1;
+        out->color = P_PAREN;
+        return true;
+    }
+
+    if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^' || c == ',') { // Operators
+        out->byte_end = offset + 1;
+        out->color = P_OPERATOR;
+        return true;
+    }
+
+    if (isdigit(c) || c == '.') { // Number: [0-9]*('.'[0-9]+)?([eE][+-]?[0-9]+)?
+        size_t i = offset;
+        bool saw_digit = false;
+
+        while (i < n && isdigit((unsigned char) utf8[i])) { i++; saw_digit = true; }
+        if (i < n && utf8[i] == '.') {
+            i++;
+            while (i < n && isdigit((unsigned char) utf8[i])) { i++; saw_digit = true; }
+        }
+        if (saw_digit && i < n && (utf8[i] == 'e' || utf8[i] == 'E')) {
+            size_t j = i + 1;
+            if (j < n && (utf8[j] == '+' || utf8[j] == '-')) j++;
+            bool exp_digit = false;
+            while (j < n && isdigit((unsigned char) utf8[j])) { j++; exp_digit = true; }
+            if (exp_digit) i = j;
+        }
+
+        out->byte_end = (saw_digit ? i : offset + 1);
+        out->color = (saw_digit ? P_NUMBER : P_DEFAULT);
+        return true;
+    }
+
+    if (isalpha(c) || c == '_') { // Identifier
+        size_t i = offset + 1;
+        while (i < n && (isalnum((unsigned char) utf8[i]) || utf8[i] == '_')) i++;
+        out->byte_end = i;
+        out->color = bench_classifyidentifier(utf8 + offset, i - offset);
+        return true;
+    }
+
+    out->byte_end = offset + 1; // Everything else
+    out->color = P_DEFAULT;
+    return true;
+}
+
+/** Configure the calc highlighter and load lines of expressions */
+static void bench_loadexpressions(inline_editor *edit, int lines) {
+    inline_setpalette(edit, (int) (sizeof(bench_palette) / sizeof(bench_palette[0])), bench_palette);
+    inline_syntaxcolor(edit, bench_syntaxcolor, NULL);
+    bench_begin(edit);
+
+    size_t len;
+    char *text = bench_corpus("sin(pi/4) + 2.5e3*(x - cos(0.25)) ^ 2, ", (size_t) lines * 64, 64, &len);
+    bench_load(edit, text, len);
+    free(text);
+}
+
+/* ----------------------------------------
+ * Completion over a large candidate set
+ * ---------------------------------------- */
+
+static char **bench_candidates;
+
+/** Sorted candidates sharing a common prefix */
+static void bench_makecandidates(void) {
+    if (bench_candidates) return;
+    bench_candidates = bench_checked(malloc(sizeof(char *) * BENCH_CANDIDATES));
+    for (int i = 0; i < BENCH_CANDIDATES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "candidate%06d", i);
+        bench_candidates[i] = bench_checked(strdup(name));
+    }
+}
+
+/** Offer each candidate that extends the last word, scanning onward from index */
+static const char *bench_complete(const char *utf8, void *ref, size_t *index) {
+    (void) ref;
+    size_t n = strlen(utf8), start = n;
+    while (start > 0 && isalnum((unsigned char) utf8[start - 1])) start--;
+    const char *partial = utf8 + start;
+    size_t plen = n - start;
+    if (!plen) return NULL;
+
+    for (size_t i = *index; i < BENCH_CANDIDATES; i++) {
+        if (strncmp(bench_candidates[i], partial, plen) == 0) {
+            *index = i + 1;
+            return bench_candidates[i] + plen;
+        }
+    }
+    return NULL;
+}
+
+/* **********************************************************************
+ * Scenarios
+ * ********************************************************************** */
+
+/** Each scenario configures the editor, calls bench_start and returns the number of operations timed */
+typedef long (*bench_fn) (inline_editor *edit);
+
+/** Type characters at the end or in the middle of a buffer of a given size */
+static long bench_typing(inline_editor *edit, size_t size, bool middle) {
+    bench_begin(edit);
+    size_t len;
+    char *text = bench_corpus(bench_ascii, size, 72, &len);
+    bench_load(edit, text, len);
+    free(text);
+    if (middle) inline_setcursorposn(edit, edit->grapheme_count / 2);
+
+    bench_clearscript();
+    const char *letters = "abcdefghijklmnopqrstuvwxyz ";
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_event(letters + i % 27, 1);
+
+    bench_start();
+    bench_play(edit);
+    return BENCH_KEYSTROKES;
+}
+
+static long bench_type10k(inline_editor *edit) { return bench_typing(edit, 10 * 1024, false); }
+static long bench_type100k(inline_editor *edit) { return bench_typing(edit, 100 * 1024, false); }
+static long bench_type100kmid(inline_editor *edit) { return bench_typing(edit, 100 * 1024, true); }
+
+/** Paste a megabyte of text in one bracketed paste */
+static long bench_paste(inline_editor *edit) {
+    bench_begin(edit);
+    size_t len;
+    char *text = bench_corpus(bench_ascii, 1024 * 1024, 72, &len);
+    bench_clearscript();
+    bench_key("\x1b[200~");
+    bench_event(text, len);
+    bench_key(TERM_PASTEEND);
+    free(text);
+
+    bench_start();
+    bench_play(edit);
+    return 1;
+}
+
+/** Split a 100 KB corpus into graphemes repeatedly */
+static long bench_graphemes(inline_editor *edit, const char *unit) {
+    const int passes = 20;
+    bench_begin(edit);
+    size_t len;
+    char *text = bench_corpus(unit, 100 * 1024, 0, &len);
+    bench_load(edit, text, len);
+    free(text);
+
+    bench_start();
+    for (int i = 0; i < passes; i++) inline_recomputegraphemes(edit);
+    return (long) (passes * len);
+}
+
+/** Stand-ins for a custom Unicode backend, installed as if supplied by the host */
+static size_t bench_customsplit(const char *in, const char *end) { return inline_graphemesplit(in, end); }
+static int bench_customwidth(const char *g, size_t len) { return inline_graphemewidth(g, len); }
+
+/** Split the emoji corpus with a custom backend, optionally through a shared cache */
+static long bench_graphemescustom(inline_editor *edit, bool cached) {
+    static inline_graphemecache *cache;
+    if (cached && !cache) cache = bench_checked(inline_newgraphemecache(bench_customsplit, bench_customwidth, 1024));
+
+    inline_setgraphemesplitter(edit, bench_customsplit);
+    inline_setgraphemewidth(edit, bench_customwidth);
+    if (cached) inline_setgraphemecache(edit, cache);
+    return bench_graphemes(edit, bench_emoji);
+}
+
+static long bench_graphemesascii(inline_editor *edit) { return bench_graphemes(edit, bench_ascii); }
+static long bench_graphemescjk(inline_editor *edit) { return bench_graphemes(edit, bench_cjk); }
+static long bench_graphemesemoji(inline_editor *edit) { return bench_graphemes(edit, bench_emoji); }
+static long bench_graphemesuncached(inline_editor *edit) { return bench_graphemescustom(edit, false); }
+static long bench_graphemescached(inline_editor *edit) { return bench_graphemescustom(edit, true); }
+
+/** Type an expression at the end of a syntax colored buffer */
+static long bench_syntaxtyping(inline_editor *edit) {
+    bench_loadexpressions(edit, 200);
+
+    bench_clearscript();
+    const char *expr = "+ tan(1.5e2) * (y - 3) ";
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_event(expr + i % (int) strlen(expr), 1);
+
+    bench_start();
+    bench_play(edit);
+    return BENCH_KEYSTROKES;
+}
+
+/** Repaint a screenful of syntax colored lines from scratch */
+static long bench_syntaxrepaint(inline_editor *edit) {
+    const int repaints = 1000;
+    bench_loadexpressions(edit, 200);
+
+    bench_start();
+    for (int i = 0; i < repaints; i++) {
+        inline_resetlinesyntax(edit);
+        edit->frame_valid = false;
+        inline_redraw(edit);
+    }
+    return repaints;
+}
+
+/** Fill the history with distinct entries */
+static void bench_loadhistory(inline_editor *edit) {
+    for (int i = 0; i < BENCH_HISTORY; i++) {
+        char entry[64];
+        snprintf(entry, sizeof(entry), "command %d --option=%d", i % 997, i);
+        inline_addhistory(edit, entry);
+    }
+}
+
+static long bench_historyadd(inline_editor *edit) {
+    inline_sethistorylength(edit, BENCH_HISTORY);
+    bench_begin(edit);
+    bench_start();
+    bench_loadhistory(edit);
+    return BENCH_HISTORY;
+}
+
+/** Browse up and back down through the history */
+static long bench_historybrowse(inline_editor *edit) {
+    inline_sethistorylength(edit, BENCH_HISTORY);
+    bench_loadhistory(edit);
+    bench_begin(edit);
+
+    bench_clearscript();
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_key("\x1b[A");
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_key("\x1b[B");
+
+    bench_start();
+    bench_play(edit);
+    return 2 * BENCH_KEYSTROKES;
+}
+
+/** Browse the entries that begin with the text typed */
+static long bench_historyprefix(inline_editor *edit) {
+    inline_sethistorylength(edit, BENCH_HISTORY);
+    inline_sethistoryprefixsearch(edit, true);
+    bench_loadhistory(edit);
+    bench_begin(edit);
+    bench_load(edit, "command 42", 10);
+
+    bench_clearscript();
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_key("\x1b[A");
+
+    bench_start();
+    bench_play(edit);
+    return BENCH_KEYSTROKES;
+}
+
+/** Type a word whose first matching candidate lies deep in the candidate set */
+static long bench_completetyping(inline_editor *edit) {
+    bench_makecandidates();
+    inline_autocomplete(edit, bench_complete, NULL);
+    bench_begin(edit);
+
+    bench_clearscript();
+    const char *word = "candidate09 ";
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_event(word + i % (int) strlen(word), 1);
+
+    bench_start();
+    bench_play(edit);
+    return BENCH_KEYSTROKES;
+}
+
+/** Cycle forward through suggestions, fetching each on demand */
+static long bench_completecycle(inline_editor *edit) {
+    bench_makecandidates();
+    inline_autocomplete(edit, bench_complete, NULL);
+    bench_begin(edit);
+    bench_clearscript();
+    bench_type("cand");
+    bench_play(edit);
+
+    bench_clearscript();
+    for (int i = 0; i < BENCH_KEYSTROKES; i++) bench_key("\t");
+
+    bench_start();
+    bench_play(edit);
+    return BENCH_KEYSTROKES;
+}
+
+/** Cycle backward from the first suggestion, which gathers every candidate */
+static long bench_completeall(inline_editor *edit) {
+    bench_makecandidates();
+    inline_autocomplete(edit, bench_complete, NULL);
+    bench_begin(edit);
+    bench_clearscript();
+    bench_type("cand");
+    bench_play(edit);
+
+    bench_clearscript();
+    bench_key("\x1b[Z");
+
+    bench_start();
+    bench_play(edit);
+    return edit->suggestions.count;
+}
+
+typedef struct {
+    const char *name;   // Scenario name, matched against the filter
+    const char *unit;   // What one operation is
+    bench_fn fn;        // Scenario
+} bench_t;
+
+static const bench_t bench_list[] = {
+    { "type/10KB",           "key",       bench_type10k },
+    { "type/100KB",          "key",       bench_type100k },
+    { "type/100KB-middle",   "key",       bench_type100kmid },
+    { "paste/1MB",           "paste",     bench_paste },
+    { "graphemes/ascii",     "byte",      bench_graphemesascii },
+    { "graphemes/cjk",       "byte",      bench_graphemescjk },
+    { "graphemes/emoji-zwj", "byte",      bench_graphemesemoji },
+    { "graphemes/custom",    "byte",      bench_graphemesuncached },
+    { "graphemes/cached",    "byte",      bench_graphemescached },
+    { "syntax/type",         "key",       bench_syntaxtyping },
+    { "syntax/repaint",      "frame",     bench_syntaxrepaint },
+    { "history/add",         "entry",     bench_historyadd },
+    { "history/browse",      "key",       bench_historybrowse },
+    { "history/prefix",      "key",       bench_historyprefix },
+    { "complete/type",       "key",       bench_completetyping },
+    { "complete/cycle",      "key",       bench_completecycle },
+    { "complete/all",        "candidate", bench_completeall },
+};
+
+/** Run a scenario BENCH_REPEATS times, each with a fresh editor, and report the fastest */
+static void bench_run(const bench_t *b) {
+    uint64_t best = UINT64_MAX;
+    bench_output_t output = { 0 };
+    bench_allocs_t allocs = { 0 };
+    long ops = 0;
+
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        inline_editor *edit = bench_checked(inline_new("> "));
+        if (!inline_setallocator(edit, bench_alloc, bench_realloc, bench_free, NULL)) {
+            fprintf(stderr, "inline_bench: could not install the allocator\n");
+            exit(EXIT_FAILURE);
+        }
+        inline_setescapetimeout(edit, 0); // Events are delivered whole, so never wait for the rest of a sequence
+
+        ops = b->fn(edit);
+        uint64_t elapsed = bench_now() - bench_start_ns;
+        if (elapsed < best) {
+            best = elapsed;
+            output = bench_output;
+            allocs = bench_allocs;
+        }
+
+        inline_free(edit);
+    }
+
+    double n = (double) (ops > 0 ? ops : 1);
+    printf("%-20s %9ld %-9s %12.1f %12.1f %10.3f %12.1f\n", b->name, ops, b->unit,
+           (double) best / n, (double) output.bytes / n,
+           (double) (allocs.allocs + allocs.reallocs) / n, (double) best / 1e6);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = (argc > 1 ? argv[1] : NULL);
+
+    printf("%-20s %9s %-9s %12s %12s %10s %12s\n", "scenario", "ops", "unit", "ns/op", "bytes/op", "allocs/op", "total ms");
+    for (size_t i = 0; i < sizeof(bench_list) / sizeof(bench_list[0]); i++) {
+        if (filter && !strstr(bench_list[i].name, filter)) continue;
+        bench_run(&bench_list[i]);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -9,11 +9,14 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <errno.h>
 
 #ifdef _WIN32
     #include <windows.h>
     #include <io.h>
     #include <conio.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
     #define read _read
     #define write _write
     #define isatty _isatty
@@ -22,27 +25,83 @@
 #else
     #include <termios.h>
     #include <unistd.h>
+    #include <poll.h>
+    #include <time.h>
     #include <sys/ioctl.h>
     #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
     #include <signal.h>
     #include <strings.h>
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <stdatomic.h>
 #endif
 
 #define INLINE_DEFAULT_BUFFER_SIZE 128
+#define INLINE_DEFAULT_OUTPUT_SIZE 1024
 #define INLINE_DEFAULT_PROMPT ">"
 
 #define INLINE_ESCAPECODE_MAXLENGTH 32
 
+#define INLINE_DEFAULT_PASTE_SIZE 256
+
+#define INLINE_HISTORY_CHUNK_SIZE 4096 // Bytes of history text stored per arena chunk
+#define INLINE_TRANSIENT_BLOCK_SIZE 1024 // Bytes per block of the arena for strings discarded when inline_readline returns
+
+#define INLINE_INPUT_BUFFER_SIZE 512 // Raw input bytes read from the terminal at once
+#define INLINE_PIPE_BUFFER_SIZE 65536 // Bytes read at once when input is not a terminal
+#define INLINE_ESCAPE_TIMEOUT 50     // Milliseconds to wait for the rest of an escape sequence before treating ESC as a keypress
+#define INLINE_INPUT_RECORDS 64      // Console input records read at once on Windows; each yields at most 8 bytes
+
 #define INLINE_INVALID -1
 
 #define INLINE_TAB_WIDTH 2
 
+#define INLINE_RESPLIT_LOOKAHEAD 16 // Bytes beyond its end that the splitter may examine to determine a grapheme's extent
+
+#define INLINE_GRAPHEMECACHE_KEY 48       // Longest key held by the shared grapheme cache; longer graphemes are not cached
+#define INLINE_GRAPHEMECACHE_PROBES 4     // Slots examined for each key
+#define INLINE_GRAPHEMECACHE_MINSIZE 64   // Fewest slots in a shared grapheme cache
+
 //#define INLINE_NO_SIGNALS // <- Uncomment to disable installation of signals
+//#define INLINE_NO_SIMD // <- Uncomment to disable vectorized scanning of ASCII text
+//#define INLINE_READ(fd, buf, n) // <- Define to take terminal input from elsewhere than read(), e.g. an in-memory script
+//#define INLINE_WRITE(fd, buf, n) // <- Define to send terminal output elsewhere than write(), e.g. an in-memory sink
+//#define INLINE_ENABLE_STATS // <- Uncomment to gather the hot path counters reported by inline_getstats
+
+#ifndef INLINE_READ
+    #define INLINE_READ(fd, buf, n) read(fd, buf, n)
+#endif
+#ifndef INLINE_WRITE
+    #define INLINE_WRITE(fd, buf, n) write(fd, buf, n)
+#endif
+
+#ifdef INLINE_ENABLE_STATS
+    #define INLINE_STAT_ADD(edit, field, n) ((edit)->stats.field += (uint64_t) (n))
+#else
+    #define INLINE_STAT_ADD(edit, field, n) ((void) 0)
+#endif
+#define INLINE_STAT(edit, field) INLINE_STAT_ADD(edit, field, 1)
+
+#ifndef INLINE_NO_SIMD
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define INLINE_SSE2
+    #elif defined(__aarch64__) || defined(_M_ARM64)
+        #include <arm_neon.h>
+        #define INLINE_NEON
+    #endif
+#endif
 
 #ifdef _WIN32
 typedef DWORD termstate_t;
+typedef CRITICAL_SECTION inline_mutex_t;
+typedef volatile LONG inline_atomic_t;
 #else
 typedef struct termios termstate_t;
+typedef pthread_mutex_t inline_mutex_t;
+typedef _Atomic uint32_t inline_atomic_t;
 #endif
 
 /* **********************************************************************
@@ -53,9 +112,114 @@ typedef struct termios termstate_t;
 typedef struct inline_stringlist {
     char **items;   // List of strings
     int count;      // Number of strings
+    int capacity;   // Allocated length of items
     int index;      // Current index
+    bool packed;    // Set if items and strings share a single allocation
+    bool transient; // Set if strings are allocated from the transient arena
 } inline_stringlist_t;
 
+/** Block of the transient string arena */
+typedef struct inline_arenablock {
+    struct inline_arenablock *next;   // Previously filled block
+    size_t size;                      // Capacity of data in bytes
+    size_t used;                      // Bytes allocated
+    char data[];                      // Strings
+} inline_arenablock_t;
+
+/** Chunk of the history string arena */
+typedef struct inline_historychunk {
+    struct inline_historychunk *next; // Next newer chunk
+    size_t size;                      // Capacity of text in bytes
+    size_t used;                      // Bytes of text allocated
+    int live;                         // Number of entries still stored in this chunk
+    void *mapping;                    // Mapped history file holding the entries instead of text, or NULL
+    size_t mapping_size;              // Length of the mapping in bytes
+    char text[];                      // Entry text
+} inline_historychunk_t;
+
+/** History entry */
+typedef struct {
+    const char *text;                 // Text, stored in the arena or a mapped history file; not NUL-terminated
+    size_t len;                       // Length in bytes
+} inline_historyentry_t;
+
+/** History stored as a ring buffer of entries, oldest first, whose text lives in a chunked arena.
+ *  Entries are evicted in the order they were added, so chunks empty and are released in order too. */
+typedef struct {
+    inline_historyentry_t *entries;   // Ring buffer of entries
+    int capacity;                     // Allocated length of entries
+    int start;                        // Slot holding the oldest entry
+    int count;                        // Number of entries
+    int index;                        // Entry being browsed, or INLINE_INVALID
+    unsigned int first_id;            // Number of entries ever evicted, which identifies the oldest entry
+    inline_historychunk_t *oldest;    // Chunk holding the oldest entry's text
+    inline_historychunk_t *newest;    // Chunk that new entries are appended to
+    inline_historychunk_t *spare;     // Released chunk retained for reuse
+} inline_historyring_t;
+
+/** Entries of the history index containing a given trigram */
+typedef struct {
+    uint32_t trigram;                 // Three bytes packed with a marker bit, or 0 if the slot is empty
+    int count;                        // Number of entry ids
+    int capacity;                     // Allocated length of ids
+    unsigned int *ids;                // Ids of entries containing the trigram, in ascending order
+} inline_trigramlist_t;
+
+/** Trigram index of history entries, stored as an open-addressed hash table */
+typedef struct {
+    inline_trigramlist_t *slots;      // Hash table of posting lists
+    int size;                         // Number of slots; a power of two
+    int used;                         // Number of occupied slots
+    unsigned int base_id;             // Id of the oldest entry when the index was built
+    bool built;                       // Set if the index covers every entry in the history
+} inline_historyindex_t;
+
+/** Cached syntax coloring of a single line */
+typedef struct {
+    inline_colorspan_t *spans;  // Colored spans; byte_end is relative to the start of the line
+    int count;                  // Number of spans
+    int size;                   // Number of spans allocated
+    uintptr_t state_in;         // Lexer state at the start of the line when the spans were computed
+    uintptr_t state_out;        // Lexer state at the end of the line
+    bool valid;                 // Set if the spans reflect the current contents of the line
+} inline_linesyntax_t;
+
+/** Node of the trie of escape sequences; children of a node are linked through their siblings */
+typedef struct {
+    int child;                  // First child, or INLINE_INVALID
+    int sibling;                // Next sibling, or INLINE_INVALID
+    unsigned char byte;         // Byte matched by this node
+    unsigned char c;            // Character reported with the key, for Ctrl+ and plain characters
+    int key;                    // keytype_t of the sequence ending at this node, or KEY_UNKNOWN
+} inline_keynode_t;
+
+/** Trie of escape sequences, excluding the leading ESC; node 0 is the root */
+typedef struct {
+    inline_keynode_t *nodes;    // Nodes of the trie
+    int count;                  // Number of nodes
+    int capacity;               // Allocated length of nodes
+} inline_keytrie_t;
+
+/** Slot of the shared grapheme cache, written under a sequence lock so that readers never wait */
+typedef struct {
+    inline_atomic_t seq;        // Even when the slot is stable; odd while it is being written
+    uint32_t epoch;             // Epoch of the cache when the entry was computed
+    uint32_t hash;              // Hash of the key and kind
+    uint8_t kind;               // INLINE_CACHE_ kind of entry, or 0 if the slot has never been written
+    uint8_t len;                // Length of the key in bytes
+    int16_t value;              // Width, or length of the grapheme for splitter entries
+    char key[INLINE_GRAPHEMECACHE_KEY]; // Grapheme bytes, followed for INLINE_CACHE_SPLIT by the next codepoint
+} inline_cacheslot_t;
+
+/** Splitter and width results shared between editors */
+struct inline_graphemecache {
+    inline_graphemefn split_fn; // Splitter whose results are cached, or NULL
+    inline_widthfn width_fn;    // Width function whose results are cached, or NULL
+    inline_cacheslot_t *slots;  // Open addressed table
+    uint32_t mask;              // Number of slots less one
+    inline_atomic_t epoch;      // Advanced to invalidate every entry
+};
+
 /** Viewport */
 typedef struct {
     int first_visible_line;  // Vertical scroll offset
@@ -66,52 +230,167 @@ typedef struct {
 
 /** The editor data structure */
 typedef struct inline_editor {
+    inline_allocfn alloc_fn;              // Allocator, or NULL to use malloc
+    inline_reallocfn realloc_fn;          // Reallocator, or NULL to use realloc
+    inline_freefn free_fn;                // Deallocator, or NULL to use free
+    void *alloc_ref;                      // User reference passed to the allocator
+    inline_arenablock_t *transient;       // Arena for per-readline strings, newest block first
+
     char *prompt;
     char *continuation_prompt;
+    int prompt_width;                     // Cached display width of the prompt
+    int continuation_prompt_width;        // Cached display width of the continuation prompt
+    bool prompt_widths_valid;             // Set if the cached prompt widths are current
 
     int ncols;                            // Number of columns
+    int nrows;                            // Number of rows
 
-    char *buffer;                         // Buffer holding UTF8
+    char *buffer;                         // Gap buffer holding UTF8
     size_t buffer_len;                    // Length of contents in bytes
     size_t buffer_size;                   // Size of buffer allocated in bytes
+    size_t gap_start;                     // Offset of the gap; unused space is the gap
 
     char *clipboard;                      // Clipboard buffer
     size_t clipboard_len;                 // Length of contents in bytes
     size_t clipboard_size;                // Size of clipboard in bytes
 
     size_t *graphemes;                    // Offset to each grapheme
+    int *widths;                          // Display width of each grapheme
+    int *columns;                         // Display column of each grapheme relative to the start of its line
     int grapheme_count;                   // Number of graphemes
     size_t grapheme_size;                 // Size of grapheme buffer in bytes
 
     size_t *lines;                        // Offset to each line
+    int *line_graphemes;                  // Grapheme index at the start of each line
     int line_count;                       // Number of lines
     size_t line_size;                     // Size of line buffer in bytes
 
     int cursor_posn;                      // Position of cursor in graphemes
     int selection_posn;                   // Selection posn in graphemes
     int term_cursor_row;                  // Record the cursor's physical row
+    int term_cursor_col;                  // Record the cursor's physical column
     int term_lines_drawn;                 // Record how many lines were previously drawn
 
+    unsigned char input[INLINE_INPUT_BUFFER_SIZE]; // Raw input awaiting decoding
+    int input_pos;                        // Next unread byte in the input buffer
+    int input_len;                        // Number of bytes in the input buffer
+    int input_mark;                       // Start of the keypress being decoded by inline_poll, or INLINE_INVALID
+    bool input_short;                     // Set if decoding ran out of input that had arrived
+    uint64_t input_due;                   // Time at which a partial sequence held by inline_poll is decoded as it stands
+    char *paste;                          // Bracketed paste still being read by inline_poll
+    size_t paste_len;                     // Length of the paste in bytes
+    size_t paste_size;                    // Size of the paste buffer in bytes
+    inline_keytrie_t keys;                // Escape sequences recognized, built on first use
+    int escape_timeout;                   // Milliseconds to wait for the rest of an escape sequence; negative waits indefinitely
+
+    char *pipe;                           // Input read ahead when stdin is not a terminal
+    size_t pipe_pos;                      // Next unread byte in pipe
+    size_t pipe_len;                      // Number of bytes in pipe
+
+    bool polling;                         // Set between inline_readline_begin and inline_readline_end
+    bool line_ready;                      // Set once the line being polled for has been accepted
+#ifdef _WIN32
+    WCHAR pending_surrogate;              // High surrogate awaiting its low half
+#endif
+
+    uint64_t *row_hashes;                 // Hash of the output drawn on each row in the last frame
+    int row_hashes_count;                 // Number of entries allocated
+    bool frame_valid;                     // Set if row_hashes reflect what is on the terminal
+
+    char *output;                         // Output buffer accumulating a frame
+    size_t output_len;                    // Length of contents in bytes
+    size_t output_size;                   // Size of output buffer in bytes
+    bool output_fallback;                 // Set if the frame being drawn was partly written out directly
+    size_t frame_bytes;                   // Bytes written by the last frame
+    int frame_writes;                     // Write calls made by the last frame
+    int max_fps;                          // Maximum redraws per second; 0 is unlimited
+    uint64_t last_frame_ms;               // Time of the last redraw from inline_now
+    inline_framefn frame_fn;              // Hook called at the end of every redraw
+    void *frame_ref;                      // User reference
+#ifdef INLINE_ENABLE_STATS
+    inline_stats_t stats;                 // Counters for the line being read
+    uint64_t keypress_ns;                 // Time the oldest keypress not yet drawn was received, or 0
+#endif
+
     inline_syntaxcolorfn syntax_fn;       // Syntax coloring callback
+    inline_incrementalsyntaxcolorfn incremental_syntax_fn; // Incremental syntax coloring callback
     void *syntax_ref;                     // User reference
 
+    inline_linesyntax_t *line_syntax;     // Cached syntax coloring for each line
+    int line_syntax_count;                // Number of lines cached
+    int line_syntax_size;                 // Number of entries allocated
+    uint64_t line_syntax_generation;      // Buffer generation the cache was built from (whole buffer callback only)
+
+    uint64_t generation;                  // Incremented whenever the contents of the buffer change
+
     int *palette;                         // Palette: list of colors
     int palette_count;                    // Length of palette list
+    char *palette_sgr;                    // Pre-formatted escape sequence for each palette entry, concatenated
+    int *palette_sgr_end;                 // Offset in palette_sgr of the end of each entry's sequence
+    bool reset_foreground;                // Reset only the attribute that changes rather than all attributes
 
     inline_completefn complete_fn;        // Autocomplete callback
     void *complete_ref;                   // User reference
 
     inline_stringlist_t suggestions;      // List of suggestions from autocompleter
     bool suggestion_shown;                // Set if renderer was able to show a suggestion
+    size_t complete_index;                // Iteration state passed to complete_fn
+    bool complete_exhausted;              // Set once complete_fn has returned NULL
+    int max_suggestions;                  // Maximum number of suggestions to gather; negative for no limit
+
+    inline_completerequestfn complete_request_fn; // Asynchronous autocomplete request callback
+    int complete_debounce;                // Delay in ms after the last keypress before a request is issued
+    bool complete_request_pending;        // Set if a request should be issued at complete_request_due
+    uint64_t complete_request_due;        // Time from inline_now at which to issue the request
+    inline_mutex_t complete_lock;         // Guards the fields below, which are shared with the host's threads
+    uint64_t complete_generation;         // Tag of the current request; earlier results are stale
+    inline_stringlist_t posted;           // Suggestions posted by the host, awaiting collection
+    bool posted_ready;                    // Set if posted holds results for complete_generation
+#ifdef _WIN32
+    HANDLE wakeup;                        // Event signaled when suggestions are posted
+#else
+    int wakeup[2];                        // Self-pipe written when suggestions are posted
+#endif
 
     inline_multilinefn multiline_fn;      // Multiline callback
+    inline_incrementalmultilinefn incremental_multiline_fn; // Incremental multiline callback
     void *multiline_ref;                  // User reference
+    size_t multiline_offset;              // Length of the start of the buffer already scanned by the incremental callback
+    uintptr_t multiline_state;            // State the incremental callback left at multiline_offset
 
     inline_graphemefn grapheme_fn;        // Custom grapheme splitter
     inline_widthfn width_fn;              // Custom grapheme width function
+    inline_graphemecache *grapheme_cache; // Shared cache of their results, or NULL
+    int ascii_widths[128];                // Widths of single byte ASCII graphemes under the current width function
+    bool ascii_widths_valid;              // Set if ascii_widths is current
 
-    inline_stringlist_t history;          // List of history entries
+    inline_historyring_t history;         // History entries
+    char *history_file;                   // File that accepted lines are appended to, or NULL
     int max_history_length;               // Maximum length of the history
+    inline_historyindex_t history_index;  // Trigram index for history search, built on first use
+
+    unsigned int *prefix_index;           // History entry ids ordered by text, built on first use
+    int prefix_count;                     // Number of ids in prefix_index
+    int prefix_capacity;                  // Allocated length of prefix_index
+    int prefix_sorted;                    // Leading ids that are ordered; the rest were added since
+    bool prefix_built;                    // Set if prefix_index covers every entry in the history
+    bool prefix_browsing;                 // Set while browsing entries that begin with history_prefix
+    bool history_prefix_search;           // Set if the up arrow after typed text visits only entries beginning with it
+    char *history_prefix;                 // Text typed before browsing began
+    unsigned int *prefix_matches;         // Ids of distinct entries beginning with the prefix, oldest first
+    int prefix_match_count;               // Number of matches
+    int prefix_match_capacity;            // Allocated length of prefix_matches
+    int prefix_match;                     // Match shown; prefix_match_count if none
+
+    bool search_active;                   // Set during incremental history search
+    bool search_failed;                   // Set if the query matches no entry
+    char *search_query;                   // Query typed during history search
+    size_t search_len;                    // Length of the query in bytes
+    size_t search_size;                   // Allocated size of the query
+    int search_match;                     // History index of the entry shown, or INLINE_INVALID
+    char *search_saved;                   // Buffer contents before the search began
+    int search_saved_cursor;              // Cursor position before the search began
+    char *search_prompt;                  // Prompt shown during history search
 
     inline_viewport viewport;             // Terminal viewport
 
@@ -129,10 +408,19 @@ typedef struct inline_editor {
 static inline_editor *inline_lasteditor = NULL;
 
 // Forward declarations
-static char *inline_strdup(const char *s);
+static char *inline_strdup(inline_editor *edit, const char *s);
+static void *inline_alloc(inline_editor *edit, size_t size);
+static void *inline_realloc(inline_editor *edit, void *p, size_t size);
+static void inline_dealloc(inline_editor *edit, void *p);
+static char *inline_transientstrdup(inline_editor *edit, const char *s, size_t len);
+static void inline_cleartransient(inline_editor *edit, bool keep);
+static bool inline_initstorage(inline_editor *edit);
 static void inline_disablerawmode(inline_editor *edit);
 static void inline_stringlist_init(inline_stringlist_t *list);
-static void inline_stringlist_clear(inline_stringlist_t *list);
+static void inline_stringlist_clear(inline_editor *edit, inline_stringlist_t *list);
+static void inline_historyring_init(inline_historyring_t *ring);
+static void inline_historyring_clear(inline_editor *edit, inline_historyring_t *ring);
+static void inline_clearhistoryindex(inline_editor *edit, inline_historyindex_t *index);
 static void inline_recomputelines(inline_editor *edit);
 static void inline_recomputegraphemes(inline_editor *edit);
 static bool inline_insert(inline_editor *edit, const char *bytes, size_t nbytes);
@@ -140,6 +428,15 @@ static void inline_clear(inline_editor *edit);
 static void inline_clearselection(inline_editor *edit);
 static void inline_clearsuggestions(inline_editor *edit);
 static bool inline_stringwidth(inline_editor *edit, const char *str, int *width);
+static void inline_updateviewportwidth(inline_editor *edit);
+static int inline_findlineafter(inline_editor *edit, int lo, int hi, size_t byte_off);
+static void inline_mutexinit(inline_mutex_t *m);
+static void inline_mutexdestroy(inline_mutex_t *m);
+static bool inline_openwakeup(inline_editor *edit);
+static void inline_closewakeup(inline_editor *edit);
+static uint64_t inline_now(void);
+static int inline_graphemewidth(const char *p, size_t len);
+static int inline_formatcolor(int color, char *seq, size_t size);
 
 /* -----------------------
  * New/free API
@@ -150,24 +447,24 @@ inline_editor *inline_new(const char *prompt) {
     inline_editor *edit = calloc(1, sizeof(*edit)); // All contents are zero'd
     if (!edit) return NULL;
 
-    edit->prompt = inline_strdup(prompt ? prompt : INLINE_DEFAULT_PROMPT);
-    if (!edit->prompt) goto inline_new_cleanup;
-
-    edit->buffer_size = INLINE_DEFAULT_BUFFER_SIZE; // Allocate initial buffer
-    edit->buffer = malloc(edit->buffer_size);
-    if (!edit->buffer) goto inline_new_cleanup;
+    inline_mutexinit(&edit->complete_lock); // Before anything that may fail, as inline_free destroys it
+#ifndef _WIN32
+    edit->wakeup[0] = edit->wakeup[1] = -1;
+#endif
+    edit->input_mark = INLINE_INVALID;
 
-    edit->buffer[0] = '\0'; // Ensure zero terminated
-    edit->buffer_len = 0;
+    edit->prompt = inline_strdup(edit, prompt ? prompt : INLINE_DEFAULT_PROMPT);
+    if (!edit->prompt || !inline_initstorage(edit)) goto inline_new_cleanup;
 
     edit->selection_posn = INLINE_INVALID; // No selection
     edit->max_history_length = INLINE_INVALID; // Unlimited history
+    edit->max_suggestions = INLINE_INVALID; // Unlimited suggestions
+    edit->escape_timeout = INLINE_ESCAPE_TIMEOUT;
 
     inline_stringlist_init(&edit->suggestions);
-    inline_stringlist_init(&edit->history);
-
-    inline_recomputegraphemes(edit);
-    inline_recomputelines(edit);
+    edit->suggestions.transient = true;
+    inline_historyring_init(&edit->history);
+    inline_stringlist_init(&edit->posted);
 
     return edit;
 
@@ -180,22 +477,118 @@ inline_new_cleanup:
 void inline_free(inline_editor *edit) {
     if (!edit) return;
 
-    free(edit->prompt);
-    free(edit->continuation_prompt);
-
-    free(edit->buffer);
-    free(edit->graphemes);
-    free(edit->lines);
-    free(edit->clipboard);
+    inline_dealloc(edit, edit->prompt);
+    inline_dealloc(edit, edit->continuation_prompt);
+
+    inline_dealloc(edit, edit->buffer);
+    inline_dealloc(edit, edit->graphemes);
+    for (int i = 0; i < edit->line_syntax_size; i++) inline_dealloc(edit, edit->line_syntax[i].spans);
+    inline_dealloc(edit, edit->line_syntax);
+    inline_dealloc(edit, edit->widths);
+    inline_dealloc(edit, edit->columns);
+    inline_dealloc(edit, edit->lines);
+    inline_dealloc(edit, edit->line_graphemes);
+    inline_dealloc(edit, edit->clipboard);
+    inline_dealloc(edit, edit->history_file);
+    inline_dealloc(edit, edit->search_query);
+    inline_dealloc(edit, edit->prefix_index);
+    inline_dealloc(edit, edit->prefix_matches);
+    inline_cleartransient(edit, false); // Holds search_saved, search_prompt and history_prefix
+    inline_dealloc(edit, edit->output);
+    inline_dealloc(edit, edit->row_hashes);
+    inline_dealloc(edit, edit->paste);
 
     inline_clearsuggestions(edit);
-    inline_stringlist_clear(&edit->history);
-
-    free(edit->palette);
+    inline_historyring_clear(edit, &edit->history);
+    inline_clearhistoryindex(edit, &edit->history_index);
+    inline_stringlist_clear(edit, &edit->posted);
+    inline_closewakeup(edit);
+    inline_mutexdestroy(&edit->complete_lock);
+
+    inline_dealloc(edit, edit->palette);
+    inline_dealloc(edit, edit->palette_sgr);
+    inline_dealloc(edit, edit->palette_sgr_end);
+    inline_dealloc(edit, edit->keys.nodes);
+    inline_dealloc(edit, edit->pipe);
 
     if (inline_lasteditor==edit) inline_lasteditor = NULL;
 
-    free(edit);
+    free(edit); // The editor itself always comes from malloc
+}
+
+/** Allocate the text buffer and its grapheme and line tables for an empty buffer */
+static bool inline_initstorage(inline_editor *edit) {
+    edit->buffer_size = INLINE_DEFAULT_BUFFER_SIZE; // Allocate initial buffer
+    edit->buffer = inline_alloc(edit, edit->buffer_size);
+    if (!edit->buffer) return false;
+
+    edit->buffer[0] = '\0'; // Ensure zero terminated
+    edit->buffer_len = 0;
+    edit->gap_start = 0;
+
+    inline_recomputegraphemes(edit);
+    inline_recomputelines(edit);
+    return true;
+}
+
+/** Release storage allocated by inline_initstorage */
+static void inline_releasestorage(inline_editor *edit) {
+    inline_dealloc(edit, edit->buffer);
+    inline_dealloc(edit, edit->graphemes);
+    inline_dealloc(edit, edit->widths);
+    inline_dealloc(edit, edit->columns);
+    inline_dealloc(edit, edit->lines);
+    inline_dealloc(edit, edit->line_graphemes);
+    edit->buffer = NULL;
+    edit->graphemes = NULL;
+    edit->widths = edit->columns = NULL;
+    edit->lines = NULL;
+    edit->line_graphemes = NULL;
+    edit->buffer_size = edit->buffer_len = edit->gap_start = 0;
+    edit->grapheme_size = edit->line_size = 0;
+    edit->grapheme_count = edit->line_count = 0;
+}
+
+/** Check whether the editor holds anything beyond what inline_new allocates */
+static bool inline_isconfigured(inline_editor *edit) {
+    return (edit->continuation_prompt || edit->palette || edit->clipboard || edit->output || edit->row_hashes ||
+            edit->line_syntax || edit->history.entries || edit->history.oldest || edit->history.spare ||
+            edit->history_file || edit->history_index.slots || edit->prefix_index || edit->prefix_matches ||
+            edit->suggestions.items || edit->posted.items || edit->search_query || edit->transient || edit->keys.nodes || edit->pipe ||
+#ifdef _WIN32
+            edit->wakeup);
+#else
+            edit->wakeup[0] >= 0);
+#endif
+}
+
+/** API function to supply a custom allocator */
+bool inline_setallocator(inline_editor *edit, inline_allocfn alloc, inline_reallocfn realloc, inline_freefn free, void *ref) {
+    if ((alloc || realloc || free) && !(alloc && realloc && free)) return false; // Supply all three or none
+    if (inline_isconfigured(edit)) return false; // Existing allocations could not be released
+
+    inline_editor old = *edit; // Retains the previous allocator and prompt
+    inline_releasestorage(edit);
+    edit->alloc_fn = alloc;
+    edit->realloc_fn = realloc;
+    edit->free_fn = free;
+    edit->alloc_ref = ref;
+
+    edit->prompt = inline_strdup(edit, old.prompt);
+    if (!edit->prompt || !inline_initstorage(edit)) { // Revert to the previous allocator
+        inline_dealloc(edit, edit->prompt);
+        inline_releasestorage(edit);
+        edit->alloc_fn = old.alloc_fn;
+        edit->realloc_fn = old.realloc_fn;
+        edit->free_fn = old.free_fn;
+        edit->alloc_ref = old.alloc_ref;
+        edit->prompt = old.prompt;
+        inline_initstorage(edit);
+        return false;
+    }
+    inline_dealloc(&old, old.prompt);
+    edit->prompt_widths_valid = false;
+    return true;
 }
 
 /* -----------------------
@@ -205,52 +598,147 @@ void inline_free(inline_editor *edit) {
 /** API function to enable syntax coloring */
 void inline_syntaxcolor(inline_editor *edit, inline_syntaxcolorfn fn, void *ref) {
     edit->syntax_fn = fn;
+    edit->incremental_syntax_fn = NULL;
+    edit->syntax_ref = ref;
+    edit->line_syntax_count = 0; // Discard spans from any previous callback
+}
+
+/** API function to enable incremental syntax coloring */
+void inline_incrementalsyntaxcolor(inline_editor *edit, inline_incrementalsyntaxcolorfn fn, void *ref) {
+    edit->incremental_syntax_fn = fn;
+    edit->syntax_fn = NULL;
     edit->syntax_ref = ref;
+    edit->line_syntax_count = 0; // Discard spans from any previous callback
+}
+
+/** Format the escape sequence for each palette entry once, so the renderer can copy them directly */
+static bool inline_formatpalette(inline_editor *edit) {
+    char seq[INLINE_ESCAPECODE_MAXLENGTH];
+    size_t total = 0;
+    for (int i = 0; i < edit->palette_count; i++) total += (size_t) inline_formatcolor(edit->palette[i], seq, sizeof(seq));
+
+    edit->palette_sgr = inline_alloc(edit, total + 1);
+    edit->palette_sgr_end = inline_alloc(edit, sizeof(int) * edit->palette_count);
+    if (!edit->palette_sgr || !edit->palette_sgr_end) return false;
+
+    int end = 0;
+    for (int i = 0; i < edit->palette_count; i++) {
+        end += inline_formatcolor(edit->palette[i], edit->palette_sgr + end, total + 1 - (size_t) end);
+        edit->palette_sgr_end[i] = end;
+    }
+    return true;
 }
 
 /** API function to set the color palette */
 bool inline_setpalette(inline_editor *edit, int count, const int *palette) {
-    free(edit->palette); // Clear any old palette data
+    inline_dealloc(edit, edit->palette); // Clear any old palette data
+    inline_dealloc(edit, edit->palette_sgr);
+    inline_dealloc(edit, edit->palette_sgr_end);
     edit->palette = NULL;
+    edit->palette_sgr = NULL;
+    edit->palette_sgr_end = NULL;
     edit->palette_count = 0;
 
     if (count <= 0 || palette == NULL) return false;
 
-    edit->palette = malloc(sizeof(int) * count);
+    edit->palette = inline_alloc(edit, sizeof(int) * count);
     if (!edit->palette) return false;
 
     memcpy(edit->palette, palette, sizeof(int) * count);
     edit->palette_count = count;
+    if (!inline_formatpalette(edit)) {
+        inline_setpalette(edit, 0, NULL); // Release the partially built palette
+        return false;
+    }
     return true;
 }
 
+/** API function to choose how colors and selection highlighting are switched off */
+void inline_setforegroundreset(inline_editor *edit, bool enable) {
+    edit->reset_foreground = enable;
+}
+
 /** API function to enable autocomplete */
 void inline_autocomplete(inline_editor *edit, inline_completefn fn, void *ref) {
     edit->complete_fn = fn;
+    edit->complete_request_fn = NULL;
+    edit->complete_ref = ref;
+}
+
+/** API function to enable asynchronous autocomplete */
+bool inline_asyncautocomplete(inline_editor *edit, inline_completerequestfn fn, void *ref, int debounce) {
+    if (fn && !inline_openwakeup(edit)) return false;
+    edit->complete_request_fn = fn;
+    edit->complete_fn = NULL;
     edit->complete_ref = ref;
+    edit->complete_debounce = (debounce > 0 ? debounce : 0);
+    return true;
 }
 
 /** API function to enable multiline editing */
 bool inline_multiline(inline_editor *edit, inline_multilinefn fn, void *ref, const char *continuation_prompt) {
     edit->multiline_fn = fn;
+    edit->incremental_multiline_fn = NULL;
     edit->multiline_ref = ref;
 
-    char *p = inline_strdup(continuation_prompt ? continuation_prompt : edit->prompt);
+    char *p = inline_strdup(edit, continuation_prompt ? continuation_prompt : edit->prompt);
     if (p) {
-        free(edit->continuation_prompt);
+        inline_dealloc(edit, edit->continuation_prompt);
         edit->continuation_prompt = p;
+        edit->prompt_widths_valid = false;
     }
     return (p!=NULL);
 }
 
+/** API function to enable multiline editing with an incremental callback */
+bool inline_incrementalmultiline(inline_editor *edit, inline_incrementalmultilinefn fn, void *ref, const char *continuation_prompt) {
+    bool ok = inline_multiline(edit, NULL, ref, continuation_prompt);
+    edit->incremental_multiline_fn = fn;
+    edit->multiline_offset = 0; // Discard state from any previous callback
+    edit->multiline_state = 0;
+    return ok;
+}
+
+/** API function to change the prompt */
+bool inline_setprompt(inline_editor *edit, const char *prompt) {
+    char *p = inline_strdup(edit, prompt ? prompt : INLINE_DEFAULT_PROMPT);
+    if (!p) return false;
+
+    inline_dealloc(edit, edit->prompt);
+    edit->prompt = p;
+    edit->prompt_widths_valid = false;
+
+    if (edit->ncols > 0) inline_updateviewportwidth(edit); // Prompt may be changed while editing
+    edit->refresh = true;
+    return true;
+}
+
 /** API function to use a custom grapheme splitter */
 void inline_setgraphemesplitter(inline_editor *edit, inline_graphemefn fn) {
     edit->grapheme_fn = fn;
+    edit->prompt_widths_valid = false;
+    inline_recomputegraphemes(edit); // Boundaries found by the old splitter must not mix with the new
+    inline_recomputelines(edit);
+    if (edit->cursor_posn > edit->grapheme_count) edit->cursor_posn = edit->grapheme_count;
+    edit->refresh = true;
 }
 
 /** API function to use a custom grapheme width function */
 void inline_setgraphemewidth(inline_editor *edit, inline_widthfn fn) {
     edit->width_fn = fn;
+    edit->prompt_widths_valid = false;
+    edit->ascii_widths_valid = false;
+    inline_recomputegraphemes(edit); // Refresh cached widths
+}
+
+/** API function to limit the redraw rate */
+void inline_setmaxfps(inline_editor *edit, int fps) {
+    edit->max_fps = (fps > 0 ? fps : 0);
+}
+
+/** API function to set how long to wait for the rest of an escape sequence */
+void inline_setescapetimeout(inline_editor *edit, int ms) {
+    edit->escape_timeout = (ms >= 0 ? ms : INLINE_INVALID);
 }
 
 /* **********************************************************************
@@ -281,14 +769,15 @@ bool inline_checksupported(void) {
     return true; // Windows and other terminals are supported
 }
 
-/** Read the width from the terminal */
-bool inline_getterminalwidth(int *width) {
+/** Read the width and height from the terminal */
+static bool inline_getterminalsize(int *width, int *height) {
 #ifdef _WIN32
     HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_SCREEN_BUFFER_INFO csbi;
 
     if (GetConsoleScreenBufferInfo(h, &csbi)) {
         if (width) *width=csbi.srWindow.Right - csbi.srWindow.Left + 1;
+        if (height) *height=csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
         return true;
     }
 #else
@@ -296,24 +785,151 @@ bool inline_getterminalwidth(int *width) {
 
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != -1 && ws.ws_col > 0) {
         if (width) *width=ws.ws_col;
+        if (height && ws.ws_row > 0) *height=ws.ws_row;
         return true;
     }
 #endif
     return false;
 }
 
-/** Update the terminal width */
+/** Read the width from the terminal */
+bool inline_getterminalwidth(int *width) {
+    return inline_getterminalsize(width, NULL);
+}
+
+/** Update the terminal width and height */
 static void inline_updateterminalwidth(inline_editor *edit) {
-    int width = 80; // fallback
-    inline_getterminalwidth(&width);
+    int width = 80, height = 24; // fallback
+    inline_getterminalsize(&width, &height);
     edit->ncols = width;
+    edit->nrows = height;
+}
+
+/** Prompt shown on the first line, which is replaced during history search */
+static const char *inline_firstprompt(inline_editor *edit) {
+    return (edit->search_active ? edit->search_prompt : edit->prompt);
+}
+
+/** Prompt shown on subsequent lines */
+static const char *inline_continuationprompt(inline_editor *edit) {
+    return (edit->continuation_prompt ? edit->continuation_prompt : edit->prompt);
+}
+
+/** Measure the prompts if their cached widths are stale */
+static void inline_measureprompts(inline_editor *edit) {
+    if (edit->prompt_widths_valid) return;
+
+    const char *first = inline_firstprompt(edit), *continuation = inline_continuationprompt(edit);
+    if (!inline_stringwidth(edit, first, &edit->prompt_width)) edit->prompt_width = 0;
+    if (continuation == first) edit->continuation_prompt_width = edit->prompt_width;
+    else if (!inline_stringwidth(edit, continuation, &edit->continuation_prompt_width)) edit->continuation_prompt_width = 0;
+
+    edit->prompt_widths_valid = true;
+}
+
+/** Obtain the prompt shown on a given line, and its display width */
+static const char *inline_lineprompt(inline_editor *edit, int line, int *width) {
+    inline_measureprompts(edit);
+    if (line == 0) {
+        *width = edit->prompt_width;
+        return inline_firstprompt(edit);
+    }
+    *width = edit->continuation_prompt_width;
+    return inline_continuationprompt(edit);
 }
 
-/** Update viewport width based on current terminal width (preserves viewport position) */
+/** Update viewport size based on current terminal size (preserves viewport position) */
 static void inline_updateviewportwidth(inline_editor *edit) {
-    int prompt_width;
-    if (!inline_stringwidth(edit, edit->prompt, &prompt_width)) prompt_width = 0;
-    edit->viewport.screen_cols = edit->ncols - prompt_width - 1; // Reserve last col to avoid pending wrap state
+    inline_measureprompts(edit);
+    edit->viewport.screen_cols = edit->ncols - edit->prompt_width - 1; // Reserve last col to avoid pending wrap state
+    edit->viewport.screen_rows = (edit->nrows > 0 ? edit->nrows : 1);
+}
+
+/* ----------------------------------------
+ * Locks and wakeups for asynchronous callbacks
+ * ---------------------------------------- */
+
+static void inline_mutexinit(inline_mutex_t *m) {
+#ifdef _WIN32
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
+
+static void inline_mutexdestroy(inline_mutex_t *m) {
+#ifdef _WIN32
+    DeleteCriticalSection(m);
+#else
+    pthread_mutex_destroy(m);
+#endif
+}
+
+static void inline_lock(inline_mutex_t *m) {
+#ifdef _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+static void inline_unlock(inline_mutex_t *m) {
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
+
+/** Create the wakeup channel used to interrupt the input loop from another thread */
+static bool inline_openwakeup(inline_editor *edit) {
+#ifdef _WIN32
+    if (!edit->wakeup) edit->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL); // Auto-reset
+    return edit->wakeup != NULL;
+#else
+    if (edit->wakeup[0] >= 0) return true;
+    if (pipe(edit->wakeup) != 0) return false;
+    for (int i = 0; i < 2; i++) {
+        fcntl(edit->wakeup[i], F_SETFL, fcntl(edit->wakeup[i], F_GETFL) | O_NONBLOCK);
+        fcntl(edit->wakeup[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+#endif
+}
+
+/** Wake the input loop; safe to call from any thread */
+static void inline_signalwakeup(inline_editor *edit) {
+#ifdef _WIN32
+    if (edit->wakeup) SetEvent(edit->wakeup);
+#else
+    if (edit->wakeup[1] >= 0) {
+        char c = 0;
+        ssize_t n = write(edit->wakeup[1], &c, 1); // A full pipe already guarantees a wakeup
+        (void) n;
+    }
+#endif
+}
+
+/** Consume pending wakeups */
+static void inline_drainwakeup(inline_editor *edit) {
+#ifndef _WIN32
+    char buf[64];
+    while (edit->wakeup[0] >= 0 && read(edit->wakeup[0], buf, sizeof(buf)) > 0);
+#else
+    (void) edit; // Event is auto-reset
+#endif
+}
+
+static void inline_closewakeup(inline_editor *edit) {
+#ifdef _WIN32
+    if (edit->wakeup) CloseHandle(edit->wakeup);
+    edit->wakeup = NULL;
+#else
+    for (int i = 0; i < 2; i++) {
+        if (edit->wakeup[i] >= 0) close(edit->wakeup[i]);
+        edit->wakeup[i] = -1;
+    }
+#endif
 }
 
 /* ----------------------------------------
@@ -492,6 +1108,10 @@ void inline_setutf8(void) {
 #endif
 }
 
+#define TERM_BRACKETEDPASTEON   "\x1b[?2004h"
+#define TERM_BRACKETEDPASTEOFF  "\x1b[?2004l"
+#define TERM_PASTEEND           "\x1b[201~"
+
 /** Enter raw mode */
 static bool inline_enablerawmode(inline_editor *edit) {
     if (edit->rawmode_enabled) return true;
@@ -545,6 +1165,8 @@ static bool inline_enablerawmode(inline_editor *edit) {
     inline_lasteditor = edit; // Record last editor
     inline_registeremergencyhandlers();
 
+    INLINE_WRITE(STDOUT_FILENO, TERM_BRACKETEDPASTEON, sizeof(TERM_BRACKETEDPASTEON) - 1); // Ask the terminal to delimit pastes
+
     edit->rawmode_enabled = true;
     return true;
 }
@@ -553,6 +1175,8 @@ static bool inline_enablerawmode(inline_editor *edit) {
 static void inline_disablerawmode(inline_editor *edit) {
     if (!edit || !edit->rawmode_enabled) return;
 
+    INLINE_WRITE(STDOUT_FILENO, TERM_BRACKETEDPASTEOFF, sizeof(TERM_BRACKETEDPASTEOFF) - 1);
+
 #ifdef _WIN32
     HANDLE hIn  = GetStdHandle(STD_INPUT_HANDLE);
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -575,12 +1199,76 @@ static void inline_disablerawmode(inline_editor *edit) {
 #define imin(a,b) ( a<b ? a : b)
 #define imax(a,b) ( a>b ? a : b)
 
+/* ----------------------------------------
+ * Memory allocation
+ * ---------------------------------------- */
+
+/** Allocate memory with the editor's allocator */
+static void *inline_alloc(inline_editor *edit, size_t size) {
+    return (edit->alloc_fn ? edit->alloc_fn(size, edit->alloc_ref) : malloc(size));
+}
+
+/** Resize memory with the editor's allocator; p may be NULL */
+static void *inline_realloc(inline_editor *edit, void *p, size_t size) {
+    return (edit->realloc_fn ? edit->realloc_fn(p, size, edit->alloc_ref) : realloc(p, size));
+}
+
+/** Release memory with the editor's allocator */
+static void inline_dealloc(inline_editor *edit, void *p) {
+    if (!p) return;
+    if (edit->free_fn) edit->free_fn(p, edit->alloc_ref);
+    else free(p);
+}
+
+/** Allocate size bytes for a string from the transient arena, which is cleared when inline_readline returns */
+static char *inline_transientalloc(inline_editor *edit, size_t size) {
+    inline_arenablock_t *b = edit->transient;
+    if (!b || b->size - b->used < size) {
+        size_t blocksize = (size > INLINE_TRANSIENT_BLOCK_SIZE ? size : INLINE_TRANSIENT_BLOCK_SIZE);
+        b = inline_alloc(edit, sizeof(inline_arenablock_t) + blocksize);
+        if (!b) return NULL;
+        b->next = edit->transient;
+        b->size = blocksize;
+        b->used = 0;
+        edit->transient = b;
+    }
+
+    char *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+/** Copy len bytes of a string into the transient arena, adding a terminator */
+static char *inline_transientstrdup(inline_editor *edit, const char *s, size_t len) {
+    char *p = inline_transientalloc(edit, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+/** Discard every string in the transient arena at once, optionally keeping a block for reuse */
+static void inline_cleartransient(inline_editor *edit, bool keep) {
+    inline_arenablock_t *b = edit->transient;
+    if (keep && b && b->size == INLINE_TRANSIENT_BLOCK_SIZE) {
+        b->used = 0;
+        b = b->next;
+        edit->transient->next = NULL;
+    } else edit->transient = NULL;
+
+    while (b) {
+        inline_arenablock_t *next = b->next;
+        inline_dealloc(edit, b);
+        b = next;
+    }
+}
+
 /** Duplicate a string */
-static char *inline_strdup(const char *s) {
+static char *inline_strdup(inline_editor *edit, const char *s) {
     if (!s) return NULL;
 
     size_t n = strlen(s) + 1;
-    char *p = malloc(n);
+    char *p = inline_alloc(edit, n);
     if (!p) return NULL;
 
     memcpy(p, s, n);
@@ -600,14 +1288,59 @@ static bool inline_extendbufferby(inline_editor *edit, size_t extra) {
         newcap *= 2; // Grow exponentially
     }
 
-    void *p = realloc(edit->buffer, newcap);
+    size_t oldgap = edit->buffer_size - 1 - edit->buffer_len;
+    char *p = inline_realloc(edit, edit->buffer, newcap);
     if (!p) return false;
     edit->buffer = p;
+
+    size_t newgap = newcap - 1 - edit->buffer_len; // Move text after the gap to the end of the new buffer
+    memmove(p + edit->gap_start + newgap, p + edit->gap_start + oldgap, edit->buffer_len - edit->gap_start);
     edit->buffer_size = newcap;
 
     return true;
 }
 
+/* ----------------------------------------
+ * Gap buffer
+ * ----------------------------------------
+ * Text is stored as [0, gap_start) followed by a gap of unused space, then the remainder of the text.
+ * Edits move the gap to the edit point, so edits at the cursor don't move the rest of the buffer.
+ * Graphemes never straddle the gap, so they can be read directly; a contiguous, null terminated
+ * view is obtained with inline_text by moving the gap to the end of the text. */
+
+/** Size of the gap in bytes */
+static inline size_t inline_gapsize(inline_editor *edit) {
+    return edit->buffer_size - 1 - edit->buffer_len;
+}
+
+/** Pointer to the text at logical offset off; contiguous up to the gap or the end of the text */
+static inline const char *inline_textptr(inline_editor *edit, size_t off) {
+    return edit->buffer + (off < edit->gap_start ? off : off + inline_gapsize(edit));
+}
+
+/** Byte at logical offset off */
+static inline char inline_textbyte(inline_editor *edit, size_t off) {
+    return *inline_textptr(edit, off);
+}
+
+/** Move the gap so that it begins at logical offset off */
+static void inline_movegap(inline_editor *edit, size_t off) {
+    size_t gap = inline_gapsize(edit);
+    if (off < edit->gap_start) {
+        memmove(edit->buffer + off + gap, edit->buffer + off, edit->gap_start - off);
+    } else if (off > edit->gap_start) {
+        memmove(edit->buffer + edit->gap_start, edit->buffer + edit->gap_start + gap, off - edit->gap_start);
+    }
+    edit->gap_start = off;
+}
+
+/** Obtain the contents of the buffer as a contiguous, null terminated string */
+static char *inline_text(inline_editor *edit) {
+    inline_movegap(edit, edit->buffer_len);
+    edit->buffer[edit->buffer_len] = '\0';
+    return edit->buffer;
+}
+
 /* ----------------------------------------
  * Grapheme splitting
  * ---------------------------------------- */
@@ -634,40 +1367,23 @@ static inline uint32_t inline_utf8decode(const unsigned char *p) {
     return 0;
 }
 
-/** Codepoint definition */
-typedef struct {
-    const unsigned char *seq;
-    size_t len;
-} codepoint_t;
+/** Suffix codepoints modify the previous codepoint, but don't join */
+static inline bool inline_issuffixextender(uint32_t cp) {
+    if (cp == 0xFE0E || cp == 0xFE0F) return true; // VS15 text presentation, VS16 emoji presentation
+    if (cp == 0x20E3) return true; // Keycap combining mark
+    return (cp >= 0x1F3FB && cp <= 0x1F3FF); // Emoji skin tone modifiers
+}
 
-#define CODEPOINT(s) { (const unsigned char *) s, sizeof(s)-1 }
+/** Match a suffix extender at p, returning its length in bytes or 0 if there is none */
+static inline size_t inline_matchsuffixextender(const unsigned char *p, const unsigned char *end, bool *vs16) {
+    if (p >= end || (*p != 0xEF && *p != 0xE2 && *p != 0xF0)) return 0; // Lead bytes of all suffix extenders
+    size_t len = inline_utf8length(*p);
+    if ((size_t)(end - p) < len) return 0;
 
-/** Suffix codepoints modify the previous codepoint, but don't join */
-static const codepoint_t suffix_extenders[] = {
-    CODEPOINT("\xEF\xB8\x8E"),    // VS15 (U+FE0E) text presentation
-    CODEPOINT("\xEF\xB8\x8F"),    // VS16 (U+FE0F) emoji presentation
-    CODEPOINT("\xE2\x83\xA3"),    // U+20E3 Keycap combining mark
-
-    // Emoji skin tone modifiers U+1F3FB–U+1F3FF
-    CODEPOINT("\xF0\x9F\x8F\xBB"), // light skin tone
-    CODEPOINT("\xF0\x9F\x8F\xBC"), // medium-light skin tone
-    CODEPOINT("\xF0\x9F\x8F\xBD"), // medium skin tone
-    CODEPOINT("\xF0\x9F\x8F\xBE"), // medium-dark skin tone
-    CODEPOINT("\xF0\x9F\x8F\xBF"), // dark skin tone
-};
-static const size_t suffix_count = sizeof(suffix_extenders) / sizeof(suffix_extenders[0]);
-#undef CODEPOINT
-
-/** Matches a codepoint against a table of possible matches */
-static size_t inline_matchcodepoint(size_t table_count, const codepoint_t *table, const unsigned char *p, const unsigned char *end) {
-    size_t remaining = (size_t)(end - p);
-    for (size_t i = 0; i < table_count; i++) {
-        const codepoint_t *cp = &table[i];
-        if (remaining >= cp->len && memcmp(p, cp->seq, cp->len) == 0) {
-            return cp->len;
-        }
-    }
-    return 0; // no match
+    uint32_t cp = inline_utf8decode(p);
+    if (!inline_issuffixextender(cp)) return 0;
+    if (cp == 0xFE0F) *vs16 = true;
+    return len;
 }
 
 static bool inline_isextendedpictographic(uint32_t cp) {
@@ -691,7 +1407,7 @@ static size_t inline_graphemesplit(const char *in, const char *end) {
     size_t len = inline_utf8length(*p);
     if (len == 0 || (size_t)(uend - p) < len) len = 1;
 
-    uint32_t prev_cp = inline_utf8decode(p); // Set basepoint
+    uint32_t prev_cp = (len == (size_t) inline_utf8length(*p) ? inline_utf8decode(p) : *p); // Set basepoint, guarding against truncated input
     bool prev_had_vs16 = false;
     p += len;
 
@@ -701,10 +1417,7 @@ static size_t inline_graphemesplit(const char *in, const char *end) {
         p += len;
     }
 
-    while ((len = inline_matchcodepoint(suffix_count, suffix_extenders, p, uend)) != 0) {
-        if (len == 3 && p[0]==0xEF && p[1]==0xB8 && p[2]==0x8F) prev_had_vs16 = true; // VS16
-        p += len;
-    }
+    while ((len = inline_matchsuffixextender(p, uend, &prev_had_vs16)) != 0) p += len;
 
     if (p < uend && inline_isregionalindicator(prev_cp)) { // Regional indicator pair
         size_t next_len = inline_utf8length(*p);
@@ -740,10 +1453,7 @@ static size_t inline_graphemesplit(const char *in, const char *end) {
             p += next_len;
         }
 
-        while ((next_len = inline_matchcodepoint(suffix_count, suffix_extenders, p, uend)) != 0) {
-            if (next_len == 3 && p[0]==0xEF && p[1]==0xB8 && p[2]==0x8F) prev_had_vs16 = true;
-            p += next_len;
-        }
+        while ((next_len = inline_matchsuffixextender(p, uend, &prev_had_vs16)) != 0) p += next_len;
     }
 
     return (size_t)(p - (const unsigned char *)in);
@@ -753,61 +1463,390 @@ static size_t inline_graphemesplit(const char *in, const char *end) {
  * Grapheme buffer
  * ---------------------------------------- */
 
-/** Compute grapheme locations */
-static void inline_recomputegraphemes(inline_editor *edit) {
-    size_t needed = edit->buffer_len + 1; // Assume 1 byte per character as a worst case + sentinel
+/** Select the grapheme splitter */
+static inline inline_graphemefn inline_splitter(inline_editor *edit) {
+    return (edit->grapheme_fn ? edit->grapheme_fn : inline_graphemesplit);
+}
 
-    size_t required_bytes = needed * sizeof(size_t); // Ensure capacity
-    if (required_bytes > edit->grapheme_size) {
-        size_t newsize = (edit->grapheme_size ? edit->grapheme_size : INLINE_DEFAULT_BUFFER_SIZE);
-        while (newsize < required_bytes) {
-            if (newsize > SIZE_MAX / 2) return;
-            newsize *= 2;
-        }
+/** Select the grapheme width function */
+static inline inline_widthfn inline_measurer(inline_editor *edit) {
+    return (edit->width_fn ? edit->width_fn : inline_graphemewidth);
+}
 
-        size_t *new = realloc(edit->graphemes, newsize);
-        if (!new) {
-            edit->grapheme_count = 0;
-            return;
-        }
+/* ----------------------------------------
+ * Shared grapheme cache
+ * ---------------------------------------- */
 
-        edit->graphemes = new;
-        edit->grapheme_size = newsize;
-    }
+/* Editors serving many sessions with the same custom splitter and width function may share a cache of their
+ * results for non-ASCII graphemes. Width entries are keyed by the grapheme. Splitter entries record that a
+ * grapheme ends before a given codepoint, keyed by the grapheme and that codepoint, or that it ends with the
+ * text. A lookup probes each codepoint boundary in turn; an entry found at one boundary also shows that the
+ * grapheme continued past every earlier one, so the answer matches the splitter's if its decision depends only
+ * on the grapheme so far and the next codepoint, as under the Unicode rules.
+ *
+ * Slots are written under a per-slot sequence lock: a writer that finds a slot busy skips the insertion, and a
+ * reader that sees the sequence change retries as a miss, so neither ever waits. Invalidation advances the
+ * epoch, which retires every entry at once. */
 
-    // Select splitter
-    inline_graphemefn fn = (edit->grapheme_fn ? edit->grapheme_fn : inline_graphemesplit);
+enum { INLINE_CACHE_WIDTH = 1, INLINE_CACHE_SPLIT, INLINE_CACHE_SPLITEND };
 
-    size_t count = 0;
-    const char *p = edit->buffer, *end = edit->buffer + edit->buffer_len;
+#define INLINE_FNV32_BASIS 2166136261u
 
-    while (p < end) { // Walk the buffer and record grapheme boundaries
-        edit->graphemes[count++] = (size_t)(p - edit->buffer);
-        size_t len = fn(p, end);
-        if (len == 0) len = 1; // Malformed grapheme
-        if (len > (size_t)(end - p)) len = (size_t)(end - p); // Size longer than buffer
-        p += len;
-    }
+#ifdef _WIN32
+static inline uint32_t inline_atomicload(inline_atomic_t *a) { return (uint32_t) InterlockedCompareExchange(a, 0, 0); }
+static inline bool inline_atomicclaim(inline_atomic_t *a, uint32_t seq) { return InterlockedCompareExchange(a, (LONG) (seq + 1), (LONG) seq) == (LONG) seq; }
+static inline void inline_atomicrelease(inline_atomic_t *a, uint32_t seq) { InterlockedExchange(a, (LONG) seq); }
+static inline void inline_atomicincrement(inline_atomic_t *a) { InterlockedIncrement(a); }
+static inline void inline_atomicfence(void) { MemoryBarrier(); }
+#else
+static inline uint32_t inline_atomicload(inline_atomic_t *a) { return atomic_load_explicit(a, memory_order_acquire); }
+static inline bool inline_atomicclaim(inline_atomic_t *a, uint32_t seq) { // Mark the slot as being written
+    bool claimed = atomic_compare_exchange_strong_explicit(a, &seq, seq + 1, memory_order_relaxed, memory_order_relaxed);
+    if (claimed) atomic_thread_fence(memory_order_release); // Order the claim before the writes that follow
+    return claimed;
+}
+static inline void inline_atomicrelease(inline_atomic_t *a, uint32_t seq) { atomic_store_explicit(a, seq, memory_order_release); }
+static inline void inline_atomicincrement(inline_atomic_t *a) { atomic_fetch_add_explicit(a, 1u, memory_order_acq_rel); }
+static inline void inline_atomicfence(void) { atomic_thread_fence(memory_order_acquire); }
+#endif
 
-    edit->graphemes[count] = edit->buffer_len; // Ensure last entry points to end of buffer
-    edit->grapheme_count = (int) count;
+/** Extend a 32 bit FNV-1a hash by some bytes */
+static inline uint32_t inline_cachehash(uint32_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) h = (h ^ (unsigned char) p[i]) * 16777619u;
+    return h;
 }
 
-/** Finds the start and end of grapheme i in bytes */
-static inline void inline_graphemerange(inline_editor *edit, int i, size_t *start, size_t *end) {
-    if (i < 0 || i >= edit->grapheme_count) { // Handle out of bounds access (incl. i representing end of line)
-        if (start) *start = edit->buffer_len;
-        if (end)   *end   = edit->buffer_len;
-        return;
-    }
+/** Distinguish the kinds of entry that share a key */
+static inline uint32_t inline_cachekey(uint32_t h, int kind) {
+    return h ^ ((uint32_t) kind * 0x9e3779b1u);
+}
 
-    if (start) *start = edit->graphemes[i];
-    if (end) *end = edit->graphemes[i+1];
+/** Look up an entry; returns true and sets value if present in the current epoch */
+static bool inline_cachelookup(inline_graphemecache *cache, int kind, uint32_t hash, const char *key, size_t len, int *value) {
+    uint32_t epoch = inline_atomicload(&cache->epoch);
+    for (uint32_t i = 0; i < INLINE_GRAPHEMECACHE_PROBES; i++) {
+        inline_cacheslot_t *slot = &cache->slots[(hash + i) & cache->mask];
+        uint32_t seq = inline_atomicload(&slot->seq);
+        if (seq & 1) continue; // Being written
+        if (!slot->kind) return false; // Insertion fills the probe sequence in order, so nothing lies beyond an unused slot
+
+        bool match = (slot->hash == hash && slot->kind == kind && slot->len == len && slot->epoch == epoch &&
+                      memcmp(slot->key, key, len) == 0);
+        int v = slot->value;
+        inline_atomicfence(); // Read the contents before checking they were not overwritten meanwhile
+        if (inline_atomicload(&slot->seq) != seq) continue;
+        if (match) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
 }
 
-/** Finds the first grapheme index using binary search whose start byte is >= byte_off */
-static int inline_findgraphemeindex(inline_editor *edit, size_t byte_off) {
-    int lo = 0, hi = edit->grapheme_count;
+/** Record an entry computed in a given epoch, unless another thread is writing the slot it would occupy */
+static void inline_cacheinsert(inline_graphemecache *cache, int kind, uint32_t hash, const char *key, size_t len, int value, uint32_t epoch) {
+    if (len > INLINE_GRAPHEMECACHE_KEY || value < INT16_MIN || value > INT16_MAX) return;
+
+    inline_cacheslot_t *slot = &cache->slots[hash & cache->mask]; // Prefer an unused or retired slot, else evict the first
+    for (uint32_t i = 0; i < INLINE_GRAPHEMECACHE_PROBES; i++) {
+        inline_cacheslot_t *s = &cache->slots[(hash + i) & cache->mask];
+        if (!s->kind || s->epoch != epoch) { slot = s; break; }
+    }
+
+    uint32_t seq = inline_atomicload(&slot->seq);
+    if ((seq & 1) || !inline_atomicclaim(&slot->seq, seq)) return;
+    slot->epoch = epoch;
+    slot->hash = hash;
+    slot->kind = (uint8_t) kind;
+    slot->len = (uint8_t) len;
+    slot->value = (int16_t) value;
+    memcpy(slot->key, key, len);
+    inline_atomicrelease(&slot->seq, seq + 2);
+}
+
+/** Check whether a grapheme of length len at p ends on a boundary found by stepping through its codepoints */
+static bool inline_cacheboundary(const char *p, size_t len) {
+    size_t l = 0;
+    while (l < len) {
+        int n = inline_utf8length((unsigned char) p[l]);
+        if (!n) return false;
+        l += (size_t) n;
+    }
+    return (l == len);
+}
+
+/** Split the grapheme at p, consulting the shared cache before calling the splitter */
+static size_t inline_cachedsplit(inline_editor *edit, inline_graphemefn fn, const char *p, const char *end) {
+    inline_graphemecache *cache = edit->grapheme_cache;
+    size_t avail = (size_t) (end - p), l = 0;
+    uint32_t h = INLINE_FNV32_BASIS; // Hash of the first l bytes
+    int value;
+
+    while (l < avail) { // Probe each codepoint boundary
+        size_t n = (size_t) inline_utf8length((unsigned char) p[l]);
+        if (!n || l + n > avail || l + n > INLINE_GRAPHEMECACHE_KEY) break;
+        h = inline_cachehash(h, p + l, n);
+        l += n;
+
+        if (l == avail) {
+            if (inline_cachelookup(cache, INLINE_CACHE_SPLITEND, inline_cachekey(h, INLINE_CACHE_SPLITEND), p, l, &value)) return l;
+            break;
+        }
+
+        size_t m = (size_t) inline_utf8length((unsigned char) p[l]); // Key on the codepoint that follows too
+        if (!m || l + m > avail || l + m > INLINE_GRAPHEMECACHE_KEY) break;
+        uint32_t hk = inline_cachekey(inline_cachehash(h, p + l, m), INLINE_CACHE_SPLIT);
+        if (inline_cachelookup(cache, INLINE_CACHE_SPLIT, hk, p, l + m, &value)) return l;
+    }
+
+    uint32_t epoch = inline_atomicload(&cache->epoch); // Before calling, so a concurrent invalidation retires the result
+    INLINE_STAT(edit, grapheme_calls);
+    size_t len = fn(p, end);
+    if (len == 0 || len > avail || len > INLINE_GRAPHEMECACHE_KEY || !inline_cacheboundary(p, len)) return len;
+
+    if (len == avail) {
+        uint32_t hk = inline_cachekey(inline_cachehash(INLINE_FNV32_BASIS, p, len), INLINE_CACHE_SPLITEND);
+        inline_cacheinsert(cache, INLINE_CACHE_SPLITEND, hk, p, len, (int) len, epoch);
+    } else {
+        size_t m = (size_t) inline_utf8length((unsigned char) p[len]);
+        if (!m || len + m > avail) return len;
+        uint32_t hk = inline_cachekey(inline_cachehash(INLINE_FNV32_BASIS, p, len + m), INLINE_CACHE_SPLIT);
+        inline_cacheinsert(cache, INLINE_CACHE_SPLIT, hk, p, len + m, (int) len, epoch);
+    }
+    return len;
+}
+
+/** Measure the grapheme at p, consulting the shared cache before calling the width function */
+static int inline_cachedwidth(inline_editor *edit, inline_widthfn fn, const char *p, size_t len) {
+    inline_graphemecache *cache = edit->grapheme_cache;
+    uint32_t hk = 0;
+    int width;
+    if (len <= INLINE_GRAPHEMECACHE_KEY) {
+        hk = inline_cachekey(inline_cachehash(INLINE_FNV32_BASIS, p, len), INLINE_CACHE_WIDTH);
+        if (inline_cachelookup(cache, INLINE_CACHE_WIDTH, hk, p, len, &width)) return width;
+    }
+
+    uint32_t epoch = inline_atomicload(&cache->epoch);
+    INLINE_STAT(edit, width_calls);
+    width = fn(p, len);
+    inline_cacheinsert(cache, INLINE_CACHE_WIDTH, hk, p, len, width, epoch);
+    return width;
+}
+
+/** Call a splitter, through the shared cache if it holds the splitter's results */
+static inline size_t inline_callsplitter(inline_editor *edit, inline_graphemefn fn, const char *p, const char *end) {
+    if (edit->grapheme_cache && fn == edit->grapheme_cache->split_fn) return inline_cachedsplit(edit, fn, p, end);
+    INLINE_STAT(edit, grapheme_calls);
+    return fn(p, end);
+}
+
+/** Call a width function, through the shared cache if it holds the function's results */
+static inline int inline_callwidth(inline_editor *edit, inline_widthfn fn, const char *p, size_t len) {
+    if (edit->grapheme_cache && fn == edit->grapheme_cache->width_fn) return inline_cachedwidth(edit, fn, p, len);
+    INLINE_STAT(edit, width_calls);
+    return fn(p, len);
+}
+
+/** API function to create a cache of splitter and width results that editors may share */
+inline_graphemecache *inline_newgraphemecache(inline_graphemefn split, inline_widthfn width, int entries) {
+    if (!split && !width) return NULL;
+    uint32_t size = INLINE_GRAPHEMECACHE_MINSIZE;
+    while (size < (uint32_t) imax(entries, 0) && size < (1u << 30)) size *= 2; // Round up to a power of two
+
+    inline_graphemecache *cache = calloc(1, sizeof(*cache)); // Shared, so not from any editor's allocator
+    if (!cache) return NULL;
+    cache->slots = calloc(size, sizeof(inline_cacheslot_t));
+    if (!cache->slots) {
+        free(cache);
+        return NULL;
+    }
+    cache->split_fn = split;
+    cache->width_fn = width;
+    cache->mask = size - 1;
+    cache->epoch = 1; // Slots that were never written carry epoch 0
+    return cache;
+}
+
+/** API function to free a shared grapheme cache */
+void inline_freegraphemecache(inline_graphemecache *cache) {
+    if (!cache) return;
+    free(cache->slots);
+    free(cache);
+}
+
+/** API function to discard every entry, e.g. when the width function's answers change */
+void inline_invalidategraphemecache(inline_graphemecache *cache) {
+    if (cache) inline_atomicincrement(&cache->epoch);
+}
+
+/** API function to use a shared grapheme cache */
+void inline_setgraphemecache(inline_editor *edit, inline_graphemecache *cache) {
+    edit->grapheme_cache = cache; // The cache returns the same results, so nothing need be remeasured
+}
+
+/** Find the length of the grapheme at p, guarding against malformed input */
+static inline size_t inline_splitnext(inline_editor *edit, inline_graphemefn fn, const char *p, const char *end) {
+    const unsigned char *u = (const unsigned char *) p;
+    if (u[0] < 0x80 && u[0] != '\r' && (p + 1 == end || u[1] < 0x80)) return 1; // ASCII followed by ASCII never joins
+
+    size_t len = inline_callsplitter(edit, fn, p, end);
+    if (len == 0) len = 1; // Malformed grapheme
+    if (len > (size_t)(end - p)) len = (size_t)(end - p); // Size longer than buffer
+    return len;
+}
+
+/** Count the leading bytes of [p, end) that are ASCII other than CR, which may join a following LF */
+static size_t inline_asciirun(const char *p, const char *end) {
+    const unsigned char *u = (const unsigned char *) p, *uend = (const unsigned char *) end;
+
+#if defined(INLINE_SSE2)
+    const __m128i cr = _mm_set1_epi8('\r');
+    while (uend - u >= 16) { // Classify 16 bytes at a time; the high bit of each byte flags non-ASCII
+        __m128i v = _mm_loadu_si128((const __m128i *) u);
+        if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, cr)))) break;
+        u += 16;
+    }
+#elif defined(INLINE_NEON)
+    const uint8x16_t cr = vdupq_n_u8('\r'), high = vdupq_n_u8(0x80);
+    while (uend - u >= 16) {
+        uint8x16_t v = vld1q_u8(u);
+        uint8x16_t flag = vorrq_u8(vcgeq_u8(v, high), vceqq_u8(v, cr));
+        if (vmaxvq_u8(flag)) break;
+        u += 16;
+    }
+#else
+    while (uend - u >= 8) { // Scalar fallback classifies a word at a time
+        uint64_t w;
+        memcpy(&w, u, sizeof(w));
+        uint64_t x = w ^ 0x0D0D0D0D0D0D0D0DULL; // Zero bytes where w has a CR
+        uint64_t hascr = (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+        if ((w & 0x8080808080808080ULL) || hascr) break;
+        u += 8;
+    }
+#endif
+
+    while (u < uend && *u < 0x80 && *u != '\r') u++; // Finish the remainder bytewise
+    return (size_t) (u - (const unsigned char *) p);
+}
+
+/** Ensure the table of ASCII grapheme widths reflects the current width function */
+static void inline_refreshasciiwidths(inline_editor *edit) {
+    if (edit->ascii_widths_valid) return;
+    inline_widthfn width_fn = inline_measurer(edit);
+    INLINE_STAT_ADD(edit, width_calls, 128);
+    for (int c = 0; c < 128; c++) {
+        char ch = (char) c;
+        edit->ascii_widths[c] = imax(width_fn(&ch, 1), 0);
+    }
+    edit->ascii_widths_valid = true;
+}
+
+/** Measure a grapheme using the current width function */
+static inline int inline_measuregrapheme(inline_editor *edit, inline_widthfn width_fn, const char *p, size_t len) {
+    if (len == 1 && (unsigned char) *p < 0x80) return edit->ascii_widths[(unsigned char) *p];
+    return imax(inline_callwidth(edit, width_fn, p, len), 0);
+}
+
+/** Ensure the grapheme buffer, and the width and column buffers that parallel it, can hold at least `entries` offsets */
+static bool inline_extendgraphemes(inline_editor *edit, size_t entries) {
+    size_t required_bytes = entries * sizeof(size_t); // Ensure capacity
+    if (required_bytes > edit->grapheme_size) {
+        size_t newsize = (edit->grapheme_size ? edit->grapheme_size : INLINE_DEFAULT_BUFFER_SIZE);
+        while (newsize < required_bytes) {
+            if (newsize > SIZE_MAX / 2) return false;
+            newsize *= 2;
+        }
+        size_t newentries = newsize / sizeof(size_t);
+
+        int *widths = inline_realloc(edit, edit->widths, newentries * sizeof(int));
+        if (!widths) return false;
+        edit->widths = widths;
+
+        int *columns = inline_realloc(edit, edit->columns, newentries * sizeof(int));
+        if (!columns) return false;
+        edit->columns = columns;
+
+        size_t *new = inline_realloc(edit, edit->graphemes, newsize);
+        if (!new) return false;
+
+        edit->graphemes = new;
+        edit->grapheme_size = newsize; // Only record the new capacity once all buffers have it
+    }
+    return true;
+}
+
+/** Recompute the columns of graphemes from `from` to the end of the line containing grapheme `to` */
+static void inline_updatecolumns(inline_editor *edit, int from, int to) {
+    int col = 0;
+    if (from > 0 && inline_textbyte(edit, edit->graphemes[from-1]) != '\n') col = edit->columns[from-1] + edit->widths[from-1];
+
+    for (int g = from; g < edit->grapheme_count; g++) {
+        if (g > from && inline_textbyte(edit, edit->graphemes[g-1]) == '\n') {
+            if (g > to) break; // Later lines are unaffected
+            col = 0;
+        }
+        edit->columns[g] = col;
+        col += edit->widths[g];
+    }
+}
+
+/** Compute grapheme locations */
+static void inline_recomputegraphemes(inline_editor *edit) {
+    edit->generation++;
+    if (!inline_extendgraphemes(edit, edit->buffer_len + 1)) { // Assume 1 byte per character as a worst case + sentinel
+        if (edit->graphemes) edit->graphemes[0] = 0;
+        edit->grapheme_count = 0;
+        return;
+    }
+
+    inline_graphemefn fn = inline_splitter(edit);
+    inline_widthfn width_fn = inline_measurer(edit);
+    inline_refreshasciiwidths(edit);
+    INLINE_STAT(edit, grapheme_recomputes);
+    INLINE_STAT_ADD(edit, bytes_rescanned, edit->buffer_len);
+
+    size_t count = 0;
+    const char *text = inline_text(edit);
+    const char *p = text, *end = text + edit->buffer_len;
+
+    while (p < end) { // Walk the buffer and record grapheme boundaries and widths
+        size_t run = inline_asciirun(p, end);
+        if (run > 0) { // Each byte of an ASCII run is a grapheme, except the last which may join what follows
+            size_t n = (p + run == end ? run : run - 1);
+            for (size_t i = 0; i < n; i++) {
+                edit->graphemes[count] = (size_t)(p + i - text);
+                edit->widths[count++] = edit->ascii_widths[(unsigned char) p[i]];
+            }
+            p += n;
+            if (p >= end) break;
+        }
+
+        size_t len = inline_splitnext(edit, fn, p, end);
+        edit->graphemes[count] = (size_t)(p - text);
+        edit->widths[count++] = inline_measuregrapheme(edit, width_fn, p, len);
+        p += len;
+    }
+
+    edit->graphemes[count] = edit->buffer_len; // Ensure last entry points to end of buffer
+    edit->grapheme_count = (int) count;
+    inline_updatecolumns(edit, 0, (int) count);
+}
+
+/** Finds the start and end of grapheme i in bytes */
+static inline void inline_graphemerange(inline_editor *edit, int i, size_t *start, size_t *end) {
+    if (i < 0 || i >= edit->grapheme_count) { // Handle out of bounds access (incl. i representing end of line)
+        if (start) *start = edit->buffer_len;
+        if (end)   *end   = edit->buffer_len;
+        return;
+    }
+
+    if (start) *start = edit->graphemes[i];
+    if (end) *end = edit->graphemes[i+1];
+}
+
+/** Finds the first grapheme index using binary search whose start byte is >= byte_off */
+static int inline_findgraphemeindex(inline_editor *edit, size_t byte_off) {
+    int lo = 0, hi = edit->grapheme_count;
 
     while (lo < hi) {
         int mid = (lo + hi) / 2;
@@ -820,34 +1859,351 @@ static int inline_findgraphemeindex(inline_editor *edit, size_t byte_off) {
     return lo;
 }
 
+/* ----------------------------------------
+ * Line syntax cache
+ * ---------------------------------------- */
+
+/** Ensure the line syntax cache can hold at least `entries` lines; new entries are empty */
+static bool inline_extendlinesyntax(inline_editor *edit, int entries) {
+    if (entries <= edit->line_syntax_size) return true;
+
+    int newsize = (edit->line_syntax_size ? edit->line_syntax_size : 8);
+    while (newsize < entries) newsize *= 2;
+
+    inline_linesyntax_t *new = inline_realloc(edit, edit->line_syntax, sizeof(inline_linesyntax_t) * newsize);
+    if (!new) return false;
+    memset(new + edit->line_syntax_size, 0, sizeof(inline_linesyntax_t) * (newsize - edit->line_syntax_size));
+
+    edit->line_syntax = new;
+    edit->line_syntax_size = newsize;
+    return true;
+}
+
+/** Check whether a syntax coloring callback is installed */
+static inline bool inline_hassyntax(inline_editor *edit) {
+    return (edit->syntax_fn || edit->incremental_syntax_fn);
+}
+
+/** Invalidate the syntax of every line */
+static void inline_resetlinesyntax(inline_editor *edit) {
+    if (!inline_hassyntax(edit) || !inline_extendlinesyntax(edit, edit->line_count)) {
+        edit->line_syntax_count = 0;
+        return;
+    }
+    for (int i = 0; i < edit->line_count; i++) edit->line_syntax[i].valid = false;
+    edit->line_syntax_count = edit->line_count;
+}
+
+/** Update the syntax cache after lines [k, k+removed) of the previous line table were replaced by `inserted`
+ *  new lines; line k-1, which contains the edit, is invalidated. Call with the line table already updated. */
+static void inline_splicelinesyntax(inline_editor *edit, int k, int removed, int inserted) {
+    if (!inline_hassyntax(edit)) return;
+    int count = edit->line_syntax_count;
+    if (count == 0 || k > count || k + removed > count ||
+        !inline_extendlinesyntax(edit, count - removed + inserted)) { inline_resetlinesyntax(edit); return; }
+
+    // Recycle the span buffers of removed lines as those of the inserted lines
+    int common = imin(removed, inserted);
+    for (int i = k + common; i < k + removed; i++) inline_dealloc(edit, edit->line_syntax[i].spans);
+
+    if (inserted < removed) {
+        memmove(edit->line_syntax + k + inserted, edit->line_syntax + k + removed, sizeof(inline_linesyntax_t) * (count - k - removed));
+        memset(edit->line_syntax + count - removed + inserted, 0, sizeof(inline_linesyntax_t) * (removed - inserted));
+    } else if (inserted > removed) {
+        for (int i = count; i < count - removed + inserted; i++) { // Release unused entries about to be overwritten
+            inline_dealloc(edit, edit->line_syntax[i].spans);
+            edit->line_syntax[i].spans = NULL;
+        }
+        memmove(edit->line_syntax + k + inserted, edit->line_syntax + k + removed, sizeof(inline_linesyntax_t) * (count - k - removed));
+        memset(edit->line_syntax + k + common, 0, sizeof(inline_linesyntax_t) * (inserted - removed));
+    }
+
+    for (int i = k; i < k + inserted; i++) edit->line_syntax[i].valid = false;
+    if (k > 0) edit->line_syntax[k-1].valid = false; // Line containing the start of the edit
+    edit->line_syntax_count = count - removed + inserted;
+
+    if (edit->line_syntax_count != edit->line_count) inline_resetlinesyntax(edit); // Defensive
+}
+
+/** Append a span to a line's cached syntax */
+static bool inline_appendspan(inline_editor *edit, inline_linesyntax_t *ls, inline_colorspan_t span) {
+    if (ls->count >= ls->size) { // Grow span buffer
+        int newsize = (ls->size ? 2 * ls->size : 8);
+        inline_colorspan_t *new = inline_realloc(edit, ls->spans, sizeof(inline_colorspan_t) * newsize);
+        if (!new) return false;
+        ls->spans = new;
+        ls->size = newsize;
+    }
+    ls->spans[ls->count++] = span;
+    return true;
+}
+
+/** Lex line i with the syntax callback, starting from a given state in the incremental case */
+static void inline_lexline(inline_editor *edit, int i, uintptr_t state) {
+    inline_linesyntax_t *ls = &edit->line_syntax[i];
+    size_t start = edit->lines[i], len = edit->lines[i+1] - start;
+
+    ls->state_in = state;
+    ls->count = 0;
+
+    inline_colorspan_t span;
+    if (edit->incremental_syntax_fn) {
+        size_t gap = edit->gap_start, end = start + len;
+        if (gap > start && gap < end) inline_movegap(edit, gap - start < end - gap ? start : end); // Make the line contiguous
+        const char *text = inline_textptr(edit, start);
+        for (size_t off = 0; INLINE_STAT(edit, syntax_calls), edit->incremental_syntax_fn(text, len, edit->syntax_ref, off, &state, &span); off = span.byte_end) {
+            if (span.byte_end <= off) break; // Spans must make progress
+            if (span.byte_end > len) span.byte_end = len;
+            if (!inline_appendspan(edit, ls, span)) break;
+        }
+    } else { // Whole buffer callback, queried from the start of the line
+        const char *text = inline_text(edit);
+        for (size_t off = start; off < start + len && (INLINE_STAT(edit, syntax_calls), edit->syntax_fn(text, edit->syntax_ref, off, &span)); off = span.byte_end) {
+            if (span.byte_end <= off) break;
+            if (span.byte_end > start + len) span.byte_end = start + len; // Clip to the line
+            span.byte_end -= start;
+            if (!inline_appendspan(edit, ls, span)) break;
+            span.byte_end += start;
+        }
+    }
+
+    ls->state_out = state;
+    ls->valid = true;
+}
+
+/** Bring syntax for lines [0, upto) up to date, re-lexing lines that changed or whose starting state changed */
+static void inline_updatelinesyntax(inline_editor *edit, int upto) {
+    if (!inline_hassyntax(edit)) return;
+    if (edit->line_syntax_count != edit->line_count ||                                 // Whole buffer callbacks may color any
+        (edit->syntax_fn && edit->line_syntax_generation != edit->generation)) {       // line differently after an edit
+        inline_resetlinesyntax(edit);
+        edit->line_syntax_generation = edit->generation;
+    }
+    if (edit->line_syntax_count != edit->line_count) return; // Could not allocate the cache
+
+    uintptr_t state = 0; // Initial state
+    for (int i = 0; i < upto && i < edit->line_count; i++) {
+        inline_linesyntax_t *ls = &edit->line_syntax[i];
+        if (!ls->valid || ls->state_in != state) inline_lexline(edit, i, state);
+        state = ls->state_out;
+    }
+}
+
+/** Find the colored span beginning at byte offset off within the line [byte_start, ...) */
+static bool inline_linespan(inline_editor *edit, size_t byte_start, size_t off, inline_colorspan_t *out) {
+    if (edit->line_syntax_count != edit->line_count) return false;
+
+    int line = inline_findlineafter(edit, 0, edit->line_count, byte_start) - 1;
+    if (line < 0 || !edit->line_syntax[line].valid) return false;
+
+    inline_linesyntax_t *ls = &edit->line_syntax[line];
+    size_t rel = off - byte_start;
+    int lo = 0, hi = ls->count; // Find first span that ends after rel
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ls->spans[mid].byte_end <= rel) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo >= ls->count) return false;
+
+    out->byte_end = byte_start + ls->spans[lo].byte_end;
+    out->color = ls->spans[lo].color;
+    return true;
+}
+
 /* ----------------------------------------
  * Line buffer
  * ---------------------------------------- */
 
 /** Compute line locations */
+static bool inline_extendlines(inline_editor *edit, size_t entries) {
+    size_t required_bytes = entries * sizeof(size_t); // Ensure capacity
+    if (required_bytes > edit->line_size) {
+        size_t newsize = (edit->line_size ? edit->line_size : sizeof(size_t) * 2);
+        while (newsize < required_bytes) {
+            if (newsize > SIZE_MAX / 2) return false;
+            newsize *= 2;
+        }
+
+        int *starts = inline_realloc(edit, edit->line_graphemes, (newsize / sizeof(size_t)) * sizeof(int));
+        if (!starts) return false;
+        edit->line_graphemes = starts;
+
+        size_t *new = inline_realloc(edit, edit->lines, newsize);
+        if (!new) return false;
+
+        edit->lines = new;
+        edit->line_size = newsize; // Only record the new capacity once both buffers have it
+    }
+    return true;
+}
+
 static void inline_recomputelines(inline_editor *edit) {
     int count = 0;
 
     for (int g = 0; g < edit->grapheme_count; g++) // Count newline graphemes
-        if (edit->buffer[edit->graphemes[g]] == '\n') count++;
+        if (inline_textbyte(edit, edit->graphemes[g]) == '\n') count++;
 
-    size_t needed = sizeof(size_t) * (count + 2); // Need count+2 entries: first line + each newline + sentinel
-    if (needed > edit->line_size) {
-        size_t *new = realloc(edit->lines, needed);
-        if (!new) return;
-        edit->lines = new;
-        edit->line_size = needed;
-    }
+    // Need count+2 entries: first line + each newline + sentinel
+    if (!inline_extendlines(edit, (size_t) count + 2)) { edit->line_count = 0; return; }
 
     int i = 0;
-    edit->lines[i++] = 0; // First line always starts at 0
+    edit->lines[i] = 0; // First line always starts at 0
+    edit->line_graphemes[i++] = 0;
 
     for (int g = 0; g < edit->grapheme_count; g++)  // Subsequent lines start after each newline
-        if (edit->buffer[edit->graphemes[g]] == '\n')
-            edit->lines[i++] = edit->graphemes[g] + 1;
+        if (inline_textbyte(edit, edit->graphemes[g]) == '\n') {
+            edit->lines[i] = edit->graphemes[g] + 1;
+            edit->line_graphemes[i++] = g + 1;
+        }
 
     edit->lines[i] = edit->buffer_len; // Sentinel
+    edit->line_graphemes[i] = edit->grapheme_count;
     edit->line_count = i;
+    inline_resetlinesyntax(edit);
+}
+
+/** Find the first line index in [lo, hi) whose start byte is > byte_off */
+static int inline_findlineafter(inline_editor *edit, int lo, int hi, size_t byte_off) {
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (edit->lines[mid] <= byte_off) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/** Update line locations after graphemes [s, s+wc) were re-split following an edit.
+ *  @param[in] old_first  - byte offset of the first re-split grapheme (unchanged by the edit)
+ *  @param[in] old_last   - byte offset, before the edit, at which the old and new boundaries resynchronized
+ *  @param[in] delta      - change in length of the buffer
+ *  @param[in] gdelta     - change in the number of graphemes */
+static void inline_updatelines(inline_editor *edit, int s, int wc, size_t old_first, size_t old_last, ptrdiff_t delta, int gdelta) {
+    int lc = edit->line_count;
+    if (lc == 0) { inline_recomputelines(edit); return; }
+
+    int nl = 0; // Count newlines in the re-split window
+    for (int g = s; g < s + wc; g++) if (inline_textbyte(edit, edit->graphemes[g]) == '\n') nl++;
+
+    // Entries 1..lc-1 with offsets in (old_first, old_last] are replaced; entry 0 is always zero
+    int k0 = inline_findlineafter(edit, 1, lc, old_first);
+    int k1 = inline_findlineafter(edit, k0, lc, old_last);
+
+    int newcount = lc - (k1 - k0) + nl;
+    if (!inline_extendlines(edit, (size_t) newcount + 1)) { inline_recomputelines(edit); return; } // Entries plus sentinel
+
+    // Shift entries after the window and insert the new ones
+    memmove(edit->lines + k0 + nl, edit->lines + k1, sizeof(size_t) * (lc - k1));
+    memmove(edit->line_graphemes + k0 + nl, edit->line_graphemes + k1, sizeof(int) * (lc - k1));
+    for (int k = k0 + nl; k < newcount; k++) {
+        edit->lines[k] = (size_t) ((ptrdiff_t) edit->lines[k] + delta);
+        edit->line_graphemes[k] += gdelta;
+    }
+
+    int k = k0;
+    for (int g = s; g < s + wc; g++)
+        if (inline_textbyte(edit, edit->graphemes[g]) == '\n') {
+            edit->lines[k] = edit->graphemes[g] + 1;
+            edit->line_graphemes[k++] = g + 1;
+        }
+
+    edit->lines[newcount] = edit->buffer_len; // Sentinel
+    edit->line_graphemes[newcount] = edit->grapheme_count;
+    edit->line_count = newcount;
+    inline_splicelinesyntax(edit, k0, k1 - k0, nl);
+}
+
+/** Update grapheme and line locations after the bytes [offset, offset+removed) of the buffer
+ *  were replaced by `inserted` new bytes.
+ *  @details Only graphemes near the edit are re-split: splitting restarts from the last grapheme
+ *           that starts at least INLINE_RESPLIT_LOOKAHEAD bytes before the edit and continues until the new boundaries rejoin the old ones, which covers
+ *           sequences that extend across the edit (ZWJ chains, regional indicator pairs, etc.).
+ *           Offsets after that point are shifted. */
+static void inline_updategraphemes(inline_editor *edit, size_t offset, size_t removed, size_t inserted) {
+    if (removed || inserted) edit->generation++; // Contents have changed
+    if (offset < edit->multiline_offset) { // Text already seen by the multiline callback changed, so it must be rescanned
+        edit->multiline_offset = 0;
+        edit->multiline_state = 0;
+    }
+    int n = edit->grapheme_count;
+    size_t old_len = edit->buffer_len + removed - inserted;
+    if (!edit->graphemes || (n == 0 && old_len > 0)) { // Nothing to update incrementally
+        inline_recomputegraphemes(edit);
+        inline_recomputelines(edit);
+        return;
+    }
+
+    ptrdiff_t delta = (ptrdiff_t) inserted - (ptrdiff_t) removed;
+
+    int s = inline_findgraphemeindex(edit, offset); // Find grapheme containing the edit
+    if (edit->graphemes[s] > offset) s--;
+    while (s > 0 && edit->graphemes[s] + INLINE_RESPLIT_LOOKAHEAD > offset) s--; // Include graphemes that may have seen the edit
+
+    int j = inline_findgraphemeindex(edit, offset + removed); // First old boundary that may resynchronize
+
+    size_t window_local[64]; // Boundaries of re-split graphemes
+    size_t *window = window_local;
+    int wc = 0, wsize = (int) (sizeof(window_local) / sizeof(window_local[0]));
+
+    // Park the gap before the re-split text so that it is contiguous; this is a grapheme boundary
+    inline_movegap(edit, edit->graphemes[s]);
+    const char *text = edit->buffer + inline_gapsize(edit); // Text after the gap, indexed by logical offset
+    const char *end = text + edit->buffer_len;
+
+    inline_graphemefn fn = inline_splitter(edit);
+    size_t p = edit->graphemes[s];
+
+    while (p < edit->buffer_len) {
+        if (p >= offset + inserted) { // Past the edit, so check whether we've rejoined the old boundaries
+            while (j < n && (ptrdiff_t) edit->graphemes[j] + delta < (ptrdiff_t) p) j++;
+            if (j < n && (ptrdiff_t) edit->graphemes[j] + delta == (ptrdiff_t) p) break;
+        }
+
+        if (wc >= wsize) { // Grow the window
+            size_t *new = (window == window_local ? inline_alloc(edit, sizeof(size_t) * wsize * 2) : inline_realloc(edit, window, sizeof(size_t) * wsize * 2));
+            if (!new) goto inline_updategraphemes_fail;
+            if (window == window_local) memcpy(new, window_local, sizeof(window_local));
+            window = new;
+            wsize *= 2;
+        }
+
+        window[wc++] = p;
+        p += inline_splitnext(edit, fn, text + p, end);
+    }
+    if (p >= edit->buffer_len) j = n; // Reached the end of the buffer
+    INLINE_STAT(edit, grapheme_recomputes);
+    INLINE_STAT_ADD(edit, bytes_rescanned, p - edit->graphemes[s]);
+
+    int newcount = s + wc + (n - j);
+    if (!inline_extendgraphemes(edit, (size_t) newcount + 1)) goto inline_updategraphemes_fail;
+
+    size_t old_first = edit->graphemes[s], old_last = edit->graphemes[j];
+
+    // Shift graphemes after the window (incl. sentinel) and copy in the re-split ones
+    memmove(edit->graphemes + s + wc, edit->graphemes + j, sizeof(size_t) * (n - j + 1));
+    for (int g = s + wc; g <= newcount; g++) edit->graphemes[g] = (size_t) ((ptrdiff_t) edit->graphemes[g] + delta);
+    memcpy(edit->graphemes + s, window, sizeof(size_t) * wc);
+
+    edit->graphemes[newcount] = edit->buffer_len; // Ensure last entry points to end of buffer
+    edit->grapheme_count = newcount;
+
+    // Widths and columns follow the same shift; only the re-split graphemes are measured
+    memmove(edit->widths + s + wc, edit->widths + j, sizeof(int) * (n - j));
+    memmove(edit->columns + s + wc, edit->columns + j, sizeof(int) * (n - j));
+    inline_widthfn width_fn = inline_measurer(edit);
+    inline_refreshasciiwidths(edit);
+    for (int g = s; g < s + wc; g++) edit->widths[g] = inline_measuregrapheme(edit, width_fn, text + edit->graphemes[g], edit->graphemes[g+1] - edit->graphemes[g]);
+    inline_updatecolumns(edit, s, s + wc);
+
+    inline_updatelines(edit, s, wc, old_first, old_last, delta, newcount - n);
+
+    if (window != window_local) inline_dealloc(edit, window);
+    return;
+
+inline_updategraphemes_fail:
+    if (window != window_local) inline_dealloc(edit, window);
+    inline_recomputegraphemes(edit);
+    inline_recomputelines(edit);
 }
 
 /* ----------------------------------------
@@ -857,11 +2213,13 @@ static void inline_recomputelines(inline_editor *edit) {
 /** Check for ZWJ, VS16, keycap */
 static bool inline_checkextenders(const unsigned char *g, size_t len) {
     for (size_t i = 0; i < len; ) {
+        size_t n = (size_t) inline_utf8length(g[i]);
+        if (n == 0 || i + n > len) return false; // Malformed
         uint32_t cp = inline_utf8decode(g + i);
         if (cp == 0x200D || cp == 0xFE0E || cp == 0xFE0F || cp == 0x20E3) return true; // ZWJ, VS15, VS16, Keycap
         if (cp >= 0x1F3FB && cp <= 0x1F3FF) return true; // Skin tones
         if (cp >= 0x1F9B0 && cp <= 0x1F9B3) return true; // Hair modifiers
-        i += inline_utf8length(g[i]);
+        i += n;
     }
     return false;
 }
@@ -870,6 +2228,7 @@ static bool inline_checkextenders(const unsigned char *g, size_t len) {
 static int inline_graphemewidth(const char *p, size_t len) {
     if (!len) return 0;
     const unsigned char *g = (const unsigned char *)p;
+    if ((size_t) inline_utf8length(*g) > len) return 1; // Malformed or truncated
     uint32_t cp = inline_utf8decode(g);
 
     if (cp == '\t') return INLINE_TAB_WIDTH; // Tab
@@ -879,7 +2238,7 @@ static int inline_graphemewidth(const char *p, size_t len) {
     if (cp >= 0xFF01 && cp <= 0xFF60) return 2; // Fullwidth forms
     if (cp >= 0xFFE0 && cp <= 0xFFE6) return 2;
     if (inline_isregionalindicator(cp) && // Regional indicator sequence
-        len > 4 && inline_isregionalindicator(inline_utf8decode(g + inline_utf8length(*g)))) return 2;
+        len >= 8 && inline_isregionalindicator(inline_utf8decode(g + 4))) return 2;
     if (inline_checkextenders(g, len)) return 2; // Emoji extenders (ZWJ, VS16, skin tones, etc.)
     if (cp >= 0x1F300 && cp <= 0x1FAFF) return 2; // Emoji
     if (cp >= 0x4E00 && cp <= 0x9FFF) return 2; // CJK Unified Ideographs
@@ -896,24 +2255,18 @@ static bool inline_stringwidth(inline_editor *edit, const char *str, int *width)
     *width = 0;
 
     while (p < end) {
-        size_t glen = split_fn(p, end);
+        size_t glen = inline_callsplitter(edit, split_fn, p, end);
         if (glen == 0) return false; // Malformed utf8 codepoint
-        *width += width_fn(p, glen);
+        *width += inline_callwidth(edit, width_fn, p, glen);
         p += glen;
     }
     return true;
 }
 
-/** Compute terminal width of grapheme range [g_start, g_end) */
+/** Compute terminal width of grapheme range [g_start, g_end), which must lie within a single line */
 static inline int inline_graphemerangewidth(inline_editor *edit, int g_start, int g_end) {
-    inline_widthfn width_fn = (edit->width_fn ? edit->width_fn : inline_graphemewidth);
-    int width = 0;
-    for (int g = g_start; g < g_end; g++) {
-        size_t s, e;
-        inline_graphemerange(edit, g, &s, &e);
-        width += width_fn(edit->buffer + s, e - s);
-    }
-    return width;
+    if (g_end <= g_start) return 0;
+    return edit->columns[g_end-1] + edit->widths[g_end-1] - edit->columns[g_start];
 }
 
 /* ----------------------------------------
@@ -924,41 +2277,66 @@ static inline int inline_graphemerangewidth(inline_editor *edit, int g_start, in
 static void inline_stringlist_init(inline_stringlist_t *list) {
     list->items=NULL;
     list->count=0;
+    list->capacity=0;
     list->index=INLINE_INVALID;
+    list->packed=false;
 }
 
 /** Add an entry to a stringlist */
-static bool inline_stringlist_add(inline_stringlist_t *list, const char *s) {
-    if (!s) return false; // Never add a null pointer
-    char *copy = inline_strdup(s);
+static bool inline_stringlist_add(inline_editor *edit, inline_stringlist_t *list, const char *s) {
+    if (!s || list->packed) return false; // Never add a null pointer; packed lists are immutable
+    char *copy = (list->transient ? inline_transientstrdup(edit, s, strlen(s)) : inline_strdup(edit, s));
     if (!copy) return false;
-    char **newitems = realloc(list->items, sizeof(char*) * (list->count + 1));
-    if (!newitems) { free(copy); return false; } // Don't update if realloc fails
+    if (list->count >= list->capacity) {
+        int newcapacity = (list->capacity ? 2*list->capacity : 4);
+        char **newitems = inline_realloc(edit, list->items, sizeof(char*) * newcapacity);
+        if (!newitems) { if (!list->transient) inline_dealloc(edit, copy); return false; } // Don't update if realloc fails
+        list->items = newitems;
+        list->capacity = newcapacity;
+    }
 
-    list->items = newitems;
     list->items[list->count] = copy;
     list->count++;
     return true;
 }
 
-/** Removes and frees the first element of the stringlist;  */
-static void inline_stringlist_popfront(inline_stringlist_t *list) {
-    if (list->count == 0) return;
-    free(list->items[0]);
+/** Fill an empty stringlist with copies of count strings, using a single allocation for the item
+ *  pointers and the text they point to */
+static bool inline_stringlist_pack(inline_editor *edit, inline_stringlist_t *list, int count, const char * const *strings) {
+    if (count <= 0) return true;
+    size_t size = sizeof(char *) * (size_t) count;
+    for (int i = 0; i < count; i++) {
+        if (!strings[i]) return false;
+        size += strlen(strings[i]) + 1;
+    }
+
+    char **items = inline_alloc(edit, size);
+    if (!items) return false;
+
+    char *text = (char *) (items + count);
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(strings[i]) + 1;
+        memcpy(text, strings[i], len);
+        items[i] = text;
+        text += len;
+    }
 
-    // Shift pointers down safely (overlapping copy)
-    if (list->count > 1) memmove(list->items, list->items + 1, sizeof(char*) * (list->count - 1));
-    list->count--;
+    list->items = items;
+    list->count = list->capacity = count;
+    list->packed = true;
+    return true;
 }
 
 /** Clear a stringlist */
-static void inline_stringlist_clear(inline_stringlist_t *list) {
+static void inline_stringlist_clear(inline_editor *edit, inline_stringlist_t *list) {
     if (list->items) {
-        for (int i = 0; i < list->count; i++) free(list->items[i]);
-        free(list->items);
+        if (!list->packed && !list->transient) for (int i = 0; i < list->count; i++) inline_dealloc(edit, list->items[i]);
+        inline_dealloc(edit, list->items);
     }
 
+    bool transient = list->transient; // Strings remain in the arena until it is cleared
     inline_stringlist_init(list);
+    list->transient = transient;
 }
 
 /** Get the current string in a stringlist */
@@ -1024,7 +2402,7 @@ static bool inline_copytoclipboard(inline_editor *edit, const char *string, size
             newsize *= 2;
         }
 
-        char *newbuf = realloc(edit->clipboard, newsize);
+        char *newbuf = inline_realloc(edit, edit->clipboard, newsize);
         if (!newbuf) return false; // Leave clipboard unchanged on allocation failure
 
         edit->clipboard = newbuf;
@@ -1048,28 +2426,102 @@ static bool inline_atend(inline_editor *edit) {
 
 /** Adds a suggestion to the suggestion list */
 static void inline_addsuggestion(inline_editor *edit, const char *s) {
-    inline_stringlist_add(&edit->suggestions, s);
+    inline_stringlist_add(edit, &edit->suggestions, s);
 }
 
-/** Clears the suggestion list */
+/** Clears the suggestion list, and cancels any outstanding asynchronous request */
 static void inline_clearsuggestions(inline_editor *edit) {
-    inline_stringlist_clear(&edit->suggestions);
+    inline_stringlist_clear(edit, &edit->suggestions);
+    edit->complete_index = 0;
+    edit->complete_exhausted = false;
+
+    if (!edit->complete_request_fn) return;
+    edit->complete_request_pending = false;
+    inline_lock(&edit->complete_lock);
+    edit->complete_generation++; // Results for earlier requests are now stale
+    inline_stringlist_clear(edit, &edit->posted);
+    edit->posted_ready = false;
+    inline_unlock(&edit->complete_lock);
+}
+
+/** Schedule an asynchronous request once the debounce interval has elapsed */
+static void inline_requestsuggestions(inline_editor *edit) {
+    inline_clearsuggestions(edit);
+    if (!edit->buffer || edit->selection_posn!=INLINE_INVALID || !inline_atend(edit)) return;
+    edit->complete_request_pending = true;
+    edit->complete_request_due = inline_now() + (uint64_t) edit->complete_debounce;
+}
+
+/** Issue a scheduled asynchronous request */
+static void inline_issuerequest(inline_editor *edit) {
+    edit->complete_request_pending = false;
+    inline_lock(&edit->complete_lock);
+    uint64_t generation = edit->complete_generation;
+    inline_unlock(&edit->complete_lock);
+    INLINE_STAT(edit, complete_calls);
+    edit->complete_request_fn(inline_text(edit), edit->complete_ref, generation);
+}
+
+/** Install suggestions posted by the host for the current request; returns true if any were collected */
+static bool inline_collectsuggestions(inline_editor *edit) {
+    bool collected = false;
+    inline_lock(&edit->complete_lock);
+    if (edit->posted_ready) {
+        inline_stringlist_clear(edit, &edit->suggestions);
+        edit->suggestions = edit->posted; // Take ownership
+        edit->suggestions.transient = true; // Suggestions fetched later still use the arena
+        if (edit->suggestions.count > 0) edit->suggestions.index = 0;
+        inline_stringlist_init(&edit->posted);
+        edit->posted_ready = false;
+        collected = true;
+    }
+    inline_unlock(&edit->complete_lock);
+    return collected;
+}
+
+/** API function to supply suggestions for an asynchronous request; may be called from any thread */
+bool inline_postsuggestions(inline_editor *edit, uint64_t generation, int count, const char * const *suggestions) {
+    if (edit->max_suggestions >= 0 && count > edit->max_suggestions) count = edit->max_suggestions;
+
+    inline_stringlist_t list; // Copy suggestions before taking the lock
+    inline_stringlist_init(&list);
+    if (!inline_stringlist_pack(edit, &list, count, suggestions)) return false;
+
+    bool accepted = false;
+    inline_lock(&edit->complete_lock);
+    if (generation == edit->complete_generation) {
+        inline_stringlist_clear(edit, &edit->posted);
+        edit->posted = list;
+        edit->posted_ready = true;
+        accepted = true;
+    }
+    inline_unlock(&edit->complete_lock);
+
+    if (accepted) inline_signalwakeup(edit);
+    else inline_stringlist_clear(edit, &list); // Stale
+    return accepted;
 }
 
-/** Generates suggestions by repeatedly calling the completion callback */
+/** Fetches the next suggestion from the completion callback; returns false once none remain */
+static bool inline_fetchsuggestion(inline_editor *edit) {
+    if (!edit->complete_fn || edit->complete_exhausted) return false;
+    if (edit->max_suggestions >= 0 && edit->suggestions.count >= edit->max_suggestions) return false;
+
+    INLINE_STAT(edit, complete_calls);
+    const char *s = edit->complete_fn(inline_text(edit), edit->complete_ref, &edit->complete_index);
+    if (!s) { edit->complete_exhausted = true; return false; }
+    inline_addsuggestion(edit, s);
+    return true;
+}
+
+/** Generates suggestions; only the first is fetched here, and the rest on demand as the user cycles */
 static void inline_generatesuggestions(inline_editor *edit) {
+    if (edit->complete_request_fn) { inline_requestsuggestions(edit); return; }
     if (!edit->complete_fn) return;
     inline_clearsuggestions(edit);
     if (edit->selection_posn!=INLINE_INVALID) return; // Enforce that suggestions cannot be generated while a selection is active
 
-    if (edit->buffer && inline_atend(edit)) {
-        size_t index = 0;
-        const char *s;
-        while ((s=edit->complete_fn(edit->buffer, edit->complete_ref, &index))!=0) {
-            inline_addsuggestion(edit, s);
-        }
-        if (edit->suggestions.count > 0) edit->suggestions.index = 0;
-    }
+    if (edit->buffer && inline_atend(edit) && inline_fetchsuggestion(edit)) edit->suggestions.index = 0;
 }
 
 /** Check if suggestions are available */
@@ -1085,9 +2537,488 @@ static const char *inline_currentsuggestion(inline_editor *edit) {
 
 /** Advance through the suggestions by delta (can be negative; we wrap around) */
 static void inline_advancesuggestions(inline_editor *edit, int delta) {
+    int target = edit->suggestions.index + delta;
+    if (target < 0) { // Wrapping backwards needs the rest of the list
+        while (inline_fetchsuggestion(edit));
+    } else while (target >= edit->suggestions.count && inline_fetchsuggestion(edit));
+
     inline_stringlist_advance(&edit->suggestions, delta, true);
 }
 
+/** Set the maximum number of suggestions to gather */
+void inline_setmaxsuggestions(inline_editor *edit, int max) {
+    edit->max_suggestions = (max < 0 ? INLINE_INVALID : max);
+}
+
+/* ----------------------------------------
+ * History storage
+ * ---------------------------------------- */
+
+/** Initialize an empty history ring */
+static void inline_historyring_init(inline_historyring_t *ring) {
+    ring->entries = NULL;
+    ring->capacity = 0;
+    ring->start = 0;
+    ring->count = 0;
+    ring->index = INLINE_INVALID;
+    ring->first_id = 0;
+    ring->oldest = ring->newest = ring->spare = NULL;
+}
+
+/** Release a mapped history file */
+static void inline_unmapfile(void *mapping, size_t size) {
+#ifdef _WIN32
+    (void) size;
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/** Free a chunk, unmapping any history file it holds */
+static void inline_historychunk_free(inline_editor *edit, inline_historychunk_t *c) {
+    if (c && c->mapping) inline_unmapfile(c->mapping, c->mapping_size);
+    inline_dealloc(edit, c);
+}
+
+/** Free all entries and chunks */
+static void inline_historyring_clear(inline_editor *edit, inline_historyring_t *ring) {
+    for (inline_historychunk_t *c = ring->oldest, *next; c; c = next) {
+        next = c->next;
+        inline_historychunk_free(edit, c);
+    }
+    inline_dealloc(edit, ring->spare);
+    inline_dealloc(edit, ring->entries);
+    inline_historyring_init(ring);
+}
+
+/** Returns the i'th oldest entry */
+static inline inline_historyentry_t *inline_historyring_get(inline_historyring_t *ring, int i) {
+    int slot = ring->start + i;
+    if (slot >= ring->capacity) slot -= ring->capacity;
+    return &ring->entries[slot];
+}
+
+/** Grow the ring buffer towards maxlen entries (negative for no limit), unwrapping the entries */
+static bool inline_historyring_grow(inline_editor *edit, inline_historyring_t *ring, int maxlen) {
+    int newcapacity = (ring->capacity ? 2*ring->capacity : 16);
+    if (maxlen > 0 && newcapacity > maxlen) newcapacity = maxlen;
+
+    inline_historyentry_t *entries = inline_alloc(edit, sizeof(inline_historyentry_t) * newcapacity);
+    if (!entries) return false;
+
+    for (int i = 0; i < ring->count; i++) entries[i] = *inline_historyring_get(ring, i);
+    inline_dealloc(edit, ring->entries);
+    ring->entries = entries;
+    ring->capacity = newcapacity;
+    ring->start = 0;
+    return true;
+}
+
+/** Append a chunk to the arena */
+static void inline_historyring_appendchunk(inline_historyring_t *ring, inline_historychunk_t *c) {
+    c->next = NULL;
+    c->used = 0;
+    c->live = 0;
+
+    if (ring->newest) ring->newest->next = c;
+    else ring->oldest = c;
+    ring->newest = c;
+}
+
+/** Reserve len bytes of arena storage for a new entry */
+static char *inline_historyring_reserve(inline_editor *edit, inline_historyring_t *ring, size_t len) {
+    inline_historychunk_t *c = ring->newest;
+    if (!c || c->size - c->used < len) {
+        if (ring->spare && ring->spare->size >= len) { // Reuse the released chunk
+            c = ring->spare;
+            ring->spare = NULL;
+        } else {
+            size_t size = (len > INLINE_HISTORY_CHUNK_SIZE ? len : INLINE_HISTORY_CHUNK_SIZE);
+            c = inline_alloc(edit, sizeof(inline_historychunk_t) + size);
+            if (!c) return NULL;
+            c->size = size;
+            c->mapping = NULL;
+        }
+        inline_historyring_appendchunk(ring, c);
+    }
+
+    char *out = c->text + c->used;
+    c->used += len;
+    c->live++;
+    return out;
+}
+
+/** Remove the oldest entry, releasing its chunk if it no longer holds any entries */
+static void inline_historyring_popfront(inline_editor *edit, inline_historyring_t *ring) {
+    if (ring->count == 0) return;
+    ring->start = (ring->start + 1 < ring->capacity ? ring->start + 1 : 0);
+    ring->count--;
+    ring->first_id++;
+
+    inline_historychunk_t *c = ring->oldest;
+    if (--c->live > 0) return;
+
+    ring->oldest = c->next;
+    if (c == ring->newest) ring->newest = NULL;
+    if (!ring->spare && !c->mapping && c->size == INLINE_HISTORY_CHUNK_SIZE) ring->spare = c; // Keep one for reuse
+    else inline_historychunk_free(edit, c);
+}
+
+/** Append a copy of an entry, first evicting the oldest entry if the ring holds maxlen entries */
+static bool inline_historyring_add(inline_editor *edit, inline_historyring_t *ring, const char *entry, size_t len, int maxlen) {
+    if (maxlen > 0 && ring->count >= maxlen) inline_historyring_popfront(edit, ring);
+    if (ring->count >= ring->capacity && !inline_historyring_grow(edit, ring, maxlen)) return false;
+
+    char *text = inline_historyring_reserve(edit, ring, len);
+    if (!text && len) return false;
+    if (len) memcpy(text, entry, len);
+
+    inline_historyentry_t *e = inline_historyring_get(ring, ring->count);
+    e->text = text;
+    e->len = len;
+    ring->count++;
+    return true;
+}
+
+/** Append an entry that refers to text held in the newest chunk's mapping rather than copying it */
+static bool inline_historyring_addmapped(inline_editor *edit, inline_historyring_t *ring, const char *text, size_t len, int maxlen) {
+    if (maxlen > 0 && ring->count >= maxlen) inline_historyring_popfront(edit, ring);
+    if (ring->count >= ring->capacity && !inline_historyring_grow(edit, ring, maxlen)) return false;
+
+    inline_historyentry_t *e = inline_historyring_get(ring, ring->count);
+    e->text = text;
+    e->len = len;
+    ring->newest->live++;
+    ring->count++;
+    return true;
+}
+
+/* ----------------------------------------
+ * History index
+ * ---------------------------------------- */
+
+/* Each history entry is identified by an id that increases by one per entry added, so that
+ * entry i of the ring has id first_id + i. The index maps each trigram to the ascending list
+ * of ids of the entries containing it; ids of evicted entries are skipped during searches
+ * and discarded altogether by rebuilding the index once they outnumber the live entries. */
+
+/** Pack three bytes into a trigram key, which is never zero */
+static inline uint32_t inline_trigram(const char *p) {
+    return 0x1000000u | ((uint32_t) (unsigned char) p[0] << 16) | ((uint32_t) (unsigned char) p[1] << 8) | (uint32_t) (unsigned char) p[2];
+}
+
+/** Hash a trigram key */
+static inline unsigned int inline_hashtrigram(uint32_t trigram) {
+    return (unsigned int) ((trigram * 2654435761u) >> 8);
+}
+
+/** Release the index */
+static void inline_clearhistoryindex(inline_editor *edit, inline_historyindex_t *index) {
+    for (int i = 0; i < index->size; i++) inline_dealloc(edit, index->slots[i].ids);
+    inline_dealloc(edit, index->slots);
+    index->slots = NULL;
+    index->size = index->used = 0;
+    index->base_id = 0;
+    index->built = false;
+}
+
+/** Find the slot for a trigram, which is empty if the trigram is not present */
+static inline_trigramlist_t *inline_findtrigram(inline_historyindex_t *index, uint32_t trigram) {
+    unsigned int mask = (unsigned int) index->size - 1;
+    for (unsigned int i = inline_hashtrigram(trigram) & mask; ; i = (i + 1) & mask) {
+        inline_trigramlist_t *slot = &index->slots[i];
+        if (!slot->trigram || slot->trigram == trigram) return slot;
+    }
+}
+
+/** Double the hash table */
+static bool inline_growhistoryindex(inline_editor *edit, inline_historyindex_t *index) {
+    int newsize = (index->size ? 2*index->size : 256);
+    inline_trigramlist_t *old = index->slots;
+    int oldsize = index->size;
+
+    index->slots = inline_alloc(edit, sizeof(inline_trigramlist_t) * (size_t) newsize);
+    if (!index->slots) { index->slots = old; return false; }
+    memset(index->slots, 0, sizeof(inline_trigramlist_t) * (size_t) newsize);
+    index->size = newsize;
+
+    for (int i = 0; i < oldsize; i++) {
+        if (old[i].trigram) *inline_findtrigram(index, old[i].trigram) = old[i];
+    }
+    inline_dealloc(edit, old);
+    return true;
+}
+
+/** Record that entry id contains a trigram */
+static bool inline_addtrigram(inline_editor *edit, inline_historyindex_t *index, uint32_t trigram, unsigned int id) {
+    if (4*(index->used + 1) > 3*index->size && !inline_growhistoryindex(edit, index)) return false; // Keep load below 3/4
+
+    inline_trigramlist_t *list = inline_findtrigram(index, trigram);
+    if (!list->trigram) {
+        list->trigram = trigram;
+        index->used++;
+    }
+    if (list->count > 0 && list->ids[list->count-1] == id) return true; // Trigram repeats within the entry
+
+    if (list->count >= list->capacity) {
+        int newcapacity = (list->capacity ? 2*list->capacity : 4);
+        unsigned int *ids = inline_realloc(edit, list->ids, sizeof(unsigned int) * newcapacity);
+        if (!ids) return false;
+        list->ids = ids;
+        list->capacity = newcapacity;
+    }
+    list->ids[list->count++] = id;
+    return true;
+}
+
+/** Add the i'th oldest history entry to the index */
+static bool inline_indexhistoryentry(inline_editor *edit, int i) {
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, i);
+    unsigned int id = edit->history.first_id + (unsigned int) i;
+    for (size_t k = 0; k + 3 <= e->len; k++) {
+        if (!inline_addtrigram(edit, &edit->history_index, inline_trigram(e->text + k), id)) return false;
+    }
+    return true;
+}
+
+/** Build the index over the whole history */
+static bool inline_buildhistoryindex(inline_editor *edit) {
+    inline_historyindex_t *index = &edit->history_index;
+    inline_clearhistoryindex(edit, index);
+    index->base_id = edit->history.first_id;
+
+    for (int i = 0; i < edit->history.count; i++) {
+        if (!inline_indexhistoryentry(edit, i)) {
+            inline_clearhistoryindex(edit, index); // Searches fall back to a linear scan
+            return false;
+        }
+    }
+    index->built = true;
+    return true;
+}
+
+/** Update the index after the newest entry was added, if it has been built */
+static void inline_updatehistoryindex(inline_editor *edit) {
+    inline_historyindex_t *index = &edit->history_index;
+    if (!index->built) return;
+
+    if (edit->history.first_id - index->base_id > (unsigned int) edit->history.count || // Mostly evicted ids
+        !inline_indexhistoryentry(edit, edit->history.count - 1)) {
+        inline_clearhistoryindex(edit, index); // Rebuilt on the next search
+    }
+}
+
+/** Find the first occurrence of needle within haystack */
+static const char *inline_memfind(const char *haystack, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return haystack;
+    if (nlen > hlen) return NULL;
+
+    const char *end = haystack + (hlen - nlen) + 1;
+    for (const char *p = haystack; p < end; p++) {
+        p = memchr(p, needle[0], (size_t) (end - p));
+        if (!p) return NULL;
+        if (memcmp(p, needle, nlen) == 0) return p;
+    }
+    return NULL;
+}
+
+/** Check whether history entry i contains the query; if so sets the byte offset of the match */
+static bool inline_historymatch(inline_editor *edit, int i, const char *query, size_t len, size_t *offset) {
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, i);
+    const char *p = inline_memfind(e->text, e->len, query, len);
+    if (p) *offset = (size_t) (p - e->text);
+    return (p != NULL);
+}
+
+/** Search backwards from history entry `from` for the newest entry containing the query;
+ *  returns its index and sets the byte offset of the match, or returns INLINE_INVALID */
+static int inline_searchhistory(inline_editor *edit, const char *query, size_t len, int from, size_t *offset) {
+    inline_historyring_t *ring = &edit->history;
+    if (from >= ring->count) from = ring->count - 1;
+    if (from < 0 || len == 0) return INLINE_INVALID;
+
+    if (len < 3 || (!edit->history_index.built && !inline_buildhistoryindex(edit))) { // Scan every entry
+        for (int i = from; i >= 0; i--) if (inline_historymatch(edit, i, query, len, offset)) return i;
+        return INLINE_INVALID;
+    }
+
+    // Candidates are the entries containing the query's rarest trigram
+    inline_trigramlist_t *rarest = NULL;
+    for (size_t k = 0; k + 3 <= len; k++) {
+        inline_trigramlist_t *list = inline_findtrigram(&edit->history_index, inline_trigram(query + k));
+        if (!list->trigram) return INLINE_INVALID; // No entry contains this trigram
+        if (!rarest || list->count < rarest->count) rarest = list;
+    }
+
+    // Find the last candidate no newer than `from`, then verify candidates in turn
+    unsigned int last = ring->first_id + (unsigned int) from;
+    int lo = 0, hi = rarest->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rarest->ids[mid] <= last) lo = mid + 1;
+        else hi = mid;
+    }
+    for (int k = lo - 1; k >= 0 && rarest->ids[k] >= ring->first_id; k--) {
+        int i = (int) (rarest->ids[k] - ring->first_id);
+        if (inline_historymatch(edit, i, query, len, offset)) return i;
+    }
+    return INLINE_INVALID;
+}
+
+/* ----------------------------------------
+ * History prefix index
+ * ---------------------------------------- */
+
+/* The prefix index lists entry ids ordered by text, with equal texts ordered by id, so that the
+ * entries beginning with a given prefix form a contiguous run found by binary search. Ids added
+ * since the index was ordered are appended unordered and merged in, and evicted ids discarded,
+ * before the next use; evicted ids are never compared, since their text may have been released. */
+
+/** Compare the text of two history entries, ordering equal texts by id */
+static int inline_compareentries(inline_editor *edit, unsigned int a, unsigned int b) {
+    const inline_historyentry_t *x = inline_historyring_get(&edit->history, (int) (a - edit->history.first_id));
+    const inline_historyentry_t *y = inline_historyring_get(&edit->history, (int) (b - edit->history.first_id));
+    size_t n = (x->len < y->len ? x->len : y->len);
+    int c = memcmp(x->text, y->text, n);
+    if (c) return c;
+    if (x->len != y->len) return (x->len < y->len ? -1 : 1);
+    return (a < b ? -1 : (a > b));
+}
+
+/** Merge the ordered runs ids[0..mid) and ids[mid..n) using tmp, which holds n ids */
+static void inline_mergeids(inline_editor *edit, unsigned int *ids, int mid, int n, unsigned int *tmp) {
+    int i = 0, j = mid, k = 0;
+    while (i < mid && j < n) tmp[k++] = (inline_compareentries(edit, ids[j], ids[i]) < 0 ? ids[j++] : ids[i++]);
+    while (i < mid) tmp[k++] = ids[i++];
+    while (j < n) tmp[k++] = ids[j++];
+    memcpy(ids, tmp, sizeof(unsigned int) * (size_t) n);
+}
+
+/** Order n ids by entry text with a merge sort, using tmp, which holds n ids */
+static void inline_sortids(inline_editor *edit, unsigned int *ids, int n, unsigned int *tmp) {
+    if (n < 2) return;
+    int mid = n / 2;
+    inline_sortids(edit, ids, mid, tmp);
+    inline_sortids(edit, ids + mid, n - mid, tmp);
+    inline_mergeids(edit, ids, mid, n, tmp);
+}
+
+/** Release the prefix index */
+static void inline_clearprefixindex(inline_editor *edit) {
+    inline_dealloc(edit, edit->prefix_index);
+    edit->prefix_index = NULL;
+    edit->prefix_count = edit->prefix_capacity = edit->prefix_sorted = 0;
+    edit->prefix_built = false;
+}
+
+/** Append an id to the prefix index */
+static bool inline_appendprefixindex(inline_editor *edit, unsigned int id) {
+    if (edit->prefix_count >= edit->prefix_capacity) {
+        int newcapacity = (edit->prefix_capacity ? 2*edit->prefix_capacity : 64);
+        unsigned int *ids = inline_realloc(edit, edit->prefix_index, sizeof(unsigned int) * newcapacity);
+        if (!ids) return false;
+        edit->prefix_index = ids;
+        edit->prefix_capacity = newcapacity;
+    }
+    edit->prefix_index[edit->prefix_count++] = id;
+    return true;
+}
+
+/** Record the newest entry in the prefix index, if it has been built */
+static void inline_updateprefixindex(inline_editor *edit) {
+    if (edit->prefix_built && !inline_appendprefixindex(edit, edit->history.first_id + (unsigned int) edit->history.count - 1)) {
+        inline_clearprefixindex(edit); // Rebuilt on next use
+    }
+}
+
+/** Bring the prefix index up to date, so that it holds exactly the live entries in order */
+static bool inline_prepareprefixindex(inline_editor *edit) {
+    unsigned int first = edit->history.first_id;
+    if (!edit->prefix_built) {
+        inline_clearprefixindex(edit);
+        for (int i = 0; i < edit->history.count; i++) {
+            if (!inline_appendprefixindex(edit, first + (unsigned int) i)) { inline_clearprefixindex(edit); return false; }
+        }
+        edit->prefix_built = true;
+    } else { // Discard evicted ids, preserving order
+        int n = 0, sorted = 0;
+        for (int i = 0; i < edit->prefix_count; i++) {
+            if (edit->prefix_index[i] < first) continue;
+            if (i < edit->prefix_sorted) sorted++;
+            edit->prefix_index[n++] = edit->prefix_index[i];
+        }
+        edit->prefix_count = n;
+        edit->prefix_sorted = sorted;
+    }
+    if (edit->prefix_sorted == edit->prefix_count) return true;
+
+    unsigned int *tmp = inline_alloc(edit, sizeof(unsigned int) * (size_t) edit->prefix_count);
+    if (!tmp) return false;
+    int sorted = edit->prefix_sorted, n = edit->prefix_count;
+    inline_sortids(edit, edit->prefix_index + sorted, n - sorted, tmp); // Order the recent additions
+    inline_mergeids(edit, edit->prefix_index, sorted, n, tmp);          // ...and merge them in
+    inline_dealloc(edit, tmp);
+    edit->prefix_sorted = n;
+    return true;
+}
+
+/** Compare an entry's text with a prefix; returns zero if the entry begins with it */
+static int inline_compareprefix(inline_editor *edit, unsigned int id, const char *prefix, size_t len) {
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, (int) (id - edit->history.first_id));
+    int c = memcmp(e->text, prefix, (e->len < len ? e->len : len));
+    if (c) return c;
+    return (e->len < len ? -1 : 0);
+}
+
+/** Order ids ascending for qsort */
+static int inline_compareids(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+    return (x > y) - (x < y);
+}
+
+/** Collect the distinct entries that begin with, but differ from, prefix, oldest first */
+static bool inline_findprefixmatches(inline_editor *edit, const char *prefix, size_t len) {
+    edit->prefix_match_count = 0;
+    if (!inline_prepareprefixindex(edit)) return false;
+
+    int lo = 0, hi = edit->prefix_count; // First entry not ordered before the prefix
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (inline_compareprefix(edit, edit->prefix_index[mid], prefix, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    int start = lo;
+    hi = edit->prefix_count; // First entry ordered after the prefix's run
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (inline_compareprefix(edit, edit->prefix_index[mid], prefix, len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    int end = lo;
+
+    if (end - start > edit->prefix_match_capacity) {
+        unsigned int *matches = inline_realloc(edit, edit->prefix_matches, sizeof(unsigned int) * (size_t) (end - start));
+        if (!matches) return false;
+        edit->prefix_matches = matches;
+        edit->prefix_match_capacity = end - start;
+    }
+
+    unsigned int first = edit->history.first_id;
+    for (int i = start; i < end; i++) { // Equal texts are adjacent and ordered by id, so keep the last of each
+        unsigned int id = edit->prefix_index[i];
+        const inline_historyentry_t *e = inline_historyring_get(&edit->history, (int) (id - first));
+        if (e->len == len) continue; // Identical to the prefix
+        if (i + 1 < end) {
+            const inline_historyentry_t *next = inline_historyring_get(&edit->history, (int) (edit->prefix_index[i+1] - first));
+            if (next->len == e->len && memcmp(next->text, e->text, e->len) == 0) continue;
+        }
+        edit->prefix_matches[edit->prefix_match_count++] = id;
+    }
+    if (edit->prefix_match_count > 1) qsort(edit->prefix_matches, (size_t) edit->prefix_match_count, sizeof(unsigned int), inline_compareids);
+    return true;
+}
+
 /* ----------------------------------------
  * History
  * ---------------------------------------- */
@@ -1097,46 +3028,296 @@ void inline_sethistorylength(inline_editor *edit, int maxlen) {
     edit->max_history_length=maxlen;
 
     if (maxlen > 0) { // Remove excess entries if necessary
-        while (edit->history.count > maxlen) inline_stringlist_popfront(&edit->history);
+        while (edit->history.count > maxlen) inline_historyring_popfront(edit, &edit->history);
     } else if (maxlen == 0) { // Clear history entirely
-        inline_stringlist_clear(&edit->history);
+        inline_historyring_clear(edit, &edit->history);
+        inline_clearhistoryindex(edit, &edit->history_index);
+        inline_clearprefixindex(edit);
     }
 }
 
+/** API function to choose whether history browsing begun after typing is limited to entries with that prefix */
+void inline_sethistoryprefixsearch(inline_editor *edit, bool enable) {
+    edit->history_prefix_search = enable;
+}
+
 /** Adds an entry to the history list */
 bool inline_addhistory(inline_editor *edit, const char *entry) {
     if (!entry || !*entry || !edit->max_history_length) return false; // Skip empty buffers
 
+    size_t len = strlen(entry);
     if (edit->history.count > 0) { // Avoid duplicate consecutive entries
-        const char *last = edit->history.items[edit->history.count - 1];
-        if (strcmp(last, entry) == 0) return false;
+        const inline_historyentry_t *last = inline_historyring_get(&edit->history, edit->history.count - 1);
+        if (last->len == len && memcmp(last->text, entry, len) == 0) return false;
     }
 
-    inline_stringlist_add(&edit->history, entry);
-    if (edit->max_history_length > 0 && edit->history.count > edit->max_history_length) inline_stringlist_popfront(&edit->history);
+    if (!inline_historyring_add(edit, &edit->history, entry, len, edit->max_history_length)) return false;
+    inline_updatehistoryindex(edit);
+    inline_updateprefixindex(edit);
     return true;
 }
 
 /** Advances the current history */
 static void inline_advancehistory(inline_editor *edit, int delta) {
-    int count = inline_stringlist_count(&edit->history);
+    int count = edit->history.count;
     if (count == 0) return;
 
-    // Enter history mode if we're not in it
-    if (edit->history.index == INLINE_INVALID) edit->history.index = count - 1;
-    else inline_stringlist_advance(&edit->history, delta, false); // No wrap
+    // Enter history mode if we're not in it, otherwise move without wrapping
+    int index = edit->history.index;
+    if (index == INLINE_INVALID) index = count - 1;
+    else {
+        index += delta;
+        if (index < 0) index = 0;
+        if (index >= count) index = count - 1;
+    }
+    edit->history.index = index;
 
-    // Load entry or exit history mode
-    const char *s = inline_stringlist_current(&edit->history);
+    // Load entry
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, index);
     inline_clear(edit);
-    if (s) {
-        inline_insert(edit, s, strlen(s));
-    } else edit->history.index = INLINE_INVALID; // Exit history mode
+    inline_insert(edit, e->text, e->len);
 }
 
 /** End browsing */
 static void inline_endhistorybrowsing(inline_editor *edit) {
     edit->history.index = INLINE_INVALID;
+    edit->prefix_browsing = false;
+}
+
+/** Begin browsing the entries that begin with the text in the buffer; returns false if none do */
+static bool inline_beginprefixbrowsing(inline_editor *edit) {
+    const char *text = inline_text(edit);
+    if (!inline_findprefixmatches(edit, text, edit->buffer_len) || edit->prefix_match_count == 0) return false;
+
+    char *prefix = inline_transientstrdup(edit, text, edit->buffer_len);
+    if (!prefix) return false;
+    edit->history_prefix = prefix;
+    edit->prefix_match = edit->prefix_match_count;
+    edit->prefix_browsing = true;
+    return true;
+}
+
+/** Moves through the entries that begin with the prefix; moving past the newest restores the prefix */
+static void inline_advanceprefix(inline_editor *edit, int delta) {
+    int m = edit->prefix_match + delta;
+    if (m < 0) m = 0;
+    if (m == edit->prefix_match) return;
+
+    inline_clear(edit);
+    if (m >= edit->prefix_match_count) { // Back to what was typed
+        inline_insert(edit, edit->history_prefix, strlen(edit->history_prefix));
+        inline_endhistorybrowsing(edit);
+        return;
+    }
+
+    edit->prefix_match = m;
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, (int) (edit->prefix_matches[m] - edit->history.first_id));
+    inline_insert(edit, e->text, e->len);
+}
+
+/* ----------------------------------------
+ * History files
+ * ---------------------------------------- */
+
+/* History files hold one record per entry, oldest first, each consisting of the entry's
+ * length in bytes as a decimal number, a space, the entry's text and a newline:
+ *      5 hello\n
+ * so that multiline entries round-trip, and a new entry can be appended without
+ * rewriting the file. Loading stops at the first malformed or truncated record. */
+
+/** Map a file into memory read-only; returns NULL if it is empty or cannot be mapped */
+static void *inline_mapfile(const char *path, size_t *size) {
+    void *map = NULL;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER length;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0 && (unsigned long long) length.QuadPart <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // The view keeps the mapping alive
+            *size = (size_t) length.QuadPart;
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (unsigned long long) st.st_size <= SIZE_MAX) {
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        *size = (size_t) st.st_size;
+    }
+    close(fd);
+#endif
+    return map;
+}
+
+/** Parse one history record starting at p; returns the start of the next record or NULL if malformed */
+static const char *inline_parsehistoryrecord(const char *p, const char *end, const char **text, size_t *len) {
+    size_t n = 0;
+    const char *q = p;
+    while (q < end && *q >= '0' && *q <= '9') {
+        if (n > (SIZE_MAX - 9) / 10) return NULL; // Overflow
+        n = n*10 + (size_t) (*q++ - '0');
+    }
+    if (q == p || q >= end || *q++ != ' ') return NULL;
+    if ((size_t) (end - q) < n + 1 || q[n] != '\n') return NULL; // Truncated
+
+    *text = q;
+    *len = n;
+    return q + n + 1;
+}
+
+/** API function to load history entries from a file, appending them to the history */
+bool inline_loadhistory(inline_editor *edit, const char *path) {
+    if (!path || !edit->max_history_length) return false;
+
+    size_t size = 0;
+    char *map = inline_mapfile(path, &size);
+    if (!map) return false;
+
+    inline_historychunk_t *c = inline_alloc(edit, sizeof(inline_historychunk_t));
+    if (!c) {
+        inline_unmapfile(map, size);
+        return false;
+    }
+    inline_historyring_t *ring = &edit->history;
+    c->size = 0; // No room for copied text, so later entries go into a fresh chunk
+    c->mapping = map;
+    c->mapping_size = size;
+    inline_historyring_appendchunk(ring, c);
+    c->live++; // Pin the mapping while parsing, in case the length limit evicts every entry from it
+
+    const char *text, *p = map, *end = map + size;
+    size_t len;
+    while (p < end && (p = inline_parsehistoryrecord(p, end, &text, &len))) {
+        if (len == 0) continue;
+        if (ring->count > 0) { // Skip duplicate consecutive entries
+            const inline_historyentry_t *last = inline_historyring_get(ring, ring->count - 1);
+            if (last->len == len && memcmp(last->text, text, len) == 0) continue;
+        }
+        if (!inline_historyring_addmapped(edit, ring, text, len, edit->max_history_length)) break;
+        inline_updatehistoryindex(edit);
+        inline_updateprefixindex(edit);
+    }
+
+    if (--c->live == 0) { // No entries were retained, so unlink the chunk from the end of the arena
+        inline_historychunk_t **link = &ring->oldest, *prev = NULL;
+        while (*link != c) { prev = *link; link = &prev->next; }
+        *link = NULL;
+        ring->newest = prev;
+        inline_historychunk_free(edit, c);
+    }
+    return true;
+}
+
+/** Format a history record into a contiguous buffer; the caller must free the result */
+static char *inline_formathistoryrecord(inline_editor *edit, const char *text, size_t len, size_t *size) {
+    char header[24];
+    int n = snprintf(header, sizeof(header), "%zu ", len);
+    if (n < 0) return NULL;
+
+    char *record = inline_alloc(edit, (size_t) n + len + 1);
+    if (!record) return NULL;
+    memcpy(record, header, (size_t) n);
+    memcpy(record + n, text, len);
+    record[n + len] = '\n';
+    *size = (size_t) n + len + 1;
+    return record;
+}
+
+/** API function to save the whole history to a file, replacing its contents */
+bool inline_savehistory(inline_editor *edit, const char *path) {
+    if (!path) return false;
+#ifndef _WIN32
+    char *target = realpath(path, NULL); // Replace the file a symbolic link refers to, rather than the link
+    if (target) path = target;
+#endif
+    bool success = false;
+    FILE *f = NULL;
+    size_t len = strlen(path);
+    char *tmp = inline_alloc(edit, len + sizeof(".XXXXXX")); // Entries may point into a mapping of path, so it must not be truncated
+    if (!tmp) goto inline_savehistory_cleanup;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX")); // Made unique, so that concurrent saves do not collide
+
+#ifdef _WIN32
+    int fd = INLINE_INVALID;
+    if (_mktemp_s(tmp, len + sizeof(".XXXXXX")) == 0) fd = _open(tmp, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd >= 0 && !(f = _fdopen(fd, "wb"))) _close(fd);
+#else
+    int fd = mkstemp(tmp); // Created with mode 0600, then given the mode of the file it replaces
+    struct stat st;
+    if (fd >= 0 && stat(path, &st) == 0) (void) fchmod(fd, st.st_mode & 07777); // Otherwise it stays private
+    if (fd >= 0 && !(f = fdopen(fd, "wb"))) close(fd);
+#endif
+    if (!f) {
+        if (fd >= 0) remove(tmp);
+        goto inline_savehistory_cleanup;
+    }
+
+    success = true;
+    for (int i = 0; i < edit->history.count && success; i++) {
+        const inline_historyentry_t *e = inline_historyring_get(&edit->history, i);
+        success = (fprintf(f, "%zu ", e->len) > 0 &&
+                   fwrite(e->text, 1, e->len, f) == e->len &&
+                   fputc('\n', f) != EOF);
+    }
+    if (fclose(f) != 0) success = false;
+
+    // Replace path with the new file; existing mappings keep the old file's contents
+#ifdef _WIN32
+    if (success) success = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    if (success) success = (rename(tmp, path) == 0);
+#endif
+    if (!success) remove(tmp);
+
+inline_savehistory_cleanup:
+    inline_dealloc(edit, tmp);
+#ifndef _WIN32
+    free(target);
+#endif
+    return success;
+}
+
+/** API function to set a file that accepted lines are appended to */
+bool inline_sethistoryfile(inline_editor *edit, const char *path) {
+    char *copy = NULL;
+    if (path && !(copy = inline_strdup(edit, path))) return false;
+    inline_dealloc(edit, edit->history_file);
+    edit->history_file = copy;
+    return true;
+}
+
+/** Append a single record to the history file; written with one call so that records
+ *  from concurrent sessions do not interleave */
+static bool inline_appendhistoryfile(inline_editor *edit, const char *text, size_t len) {
+    size_t size;
+    char *record = inline_formathistoryrecord(edit, text, len, &size);
+    if (!record) return false;
+
+    bool success = false;
+#ifdef _WIN32
+    int fd = _open(edit->history_file, _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(edit->history_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+#endif
+    if (fd >= 0) {
+        success = (write(fd, record, (unsigned int) size) == (int) size);
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+    inline_dealloc(edit, record);
+    return success;
 }
 
 /* ----------------------------------------
@@ -1148,10 +3329,12 @@ static void inline_reset(inline_editor *edit) {
     inline_clear(edit);
     inline_clearselection(edit);
     inline_endhistorybrowsing(edit);
-    inline_stringlist_clear(&edit->suggestions);
+    inline_stringlist_clear(edit, &edit->suggestions);
     edit->rawmode_enabled = false;
     edit->term_cursor_row = 0;
+    edit->term_cursor_col = 0;
     edit->term_lines_drawn = 0;
+    edit->frame_valid = false;
 }
 
 /* ----------------------------------------
@@ -1162,7 +3345,6 @@ static void inline_reset(inline_editor *edit) {
 static void inline_initviewport(inline_editor *edit) {
     edit->viewport.first_visible_line = 0;
     edit->viewport.first_visible_col  = 0;
-    edit->viewport.screen_rows = 1; // Will adjust for multiline editing later
     inline_updateviewportwidth(edit);
 }
 
@@ -1170,20 +3352,31 @@ static void inline_initviewport(inline_editor *edit) {
 static void inline_cursorposn(inline_editor *edit, int *out_row, int *out_col) {
     size_t byte_pos = edit->graphemes[edit->cursor_posn];  // byte offset of cursor
 
-    int row = 0; // Find the row containing the cursor
-    while (row + 1 < edit->line_count && edit->lines[row + 1] <= byte_pos) row++;
+    int row = inline_findlineafter(edit, 1, edit->line_count, byte_pos) - 1; // Find the row containing the cursor
 
     if (out_row) *out_row = row;
     // The column is found by subtracting the grapheme offset of the start of the row
-    if (out_col) *out_col = edit->cursor_posn - inline_findgraphemeindex(edit, edit->lines[row]);
+    if (out_col) *out_col = edit->cursor_posn - edit->line_graphemes[row];
+}
+
+/** Scroll the viewport vertically so that a given row is visible */
+static void inline_scrolltorow(inline_editor *edit, int row) {
+    int rows = edit->viewport.screen_rows;
+    int first = edit->viewport.first_visible_line;
+
+    if (row < first) first = row;
+    else if (row >= first + rows) first = row - rows + 1;
+    first = imin(first, edit->line_count - rows); // Don't leave blank rows below the last line
+    edit->viewport.first_visible_line = imax(first, 0);
 }
 
 /** Check the cursor is visible */
 static void inline_ensurecursorvisible(inline_editor *edit) {
     int cursor_row, cursor_col;
     inline_cursorposn(edit, &cursor_row, &cursor_col);
+    inline_scrolltorow(edit, cursor_row);
 
-    int line_start_g = inline_findgraphemeindex(edit, edit->lines[cursor_row]);
+    int line_start_g = edit->line_graphemes[cursor_row];
     int cursor_g = line_start_g + cursor_col;
 
     int cursor_term_col = inline_graphemerangewidth(edit, line_start_g, cursor_g);
@@ -1211,109 +3404,319 @@ static void inline_ensurecursorvisible(inline_editor *edit) {
 #define TERM_SHOWCURSOR         "\x1b[?25h"
 #define TERM_FAINT              "\x1b[2m"
 #define TERM_INVERSEVIDEO       "\x1b[7m"
+#define TERM_INVERSEVIDEOOFF    "\x1b[27m"
 
 /** Write an escape sequence to the terminal */
 void inline_emit(const char *seq) {
-    write(STDOUT_FILENO, seq, (unsigned int) strlen(seq));
+    INLINE_WRITE(STDOUT_FILENO, seq, (unsigned int) strlen(seq));
 }
 
-/** Writes an escape sequence to produce a given color */
-void inline_emitcolor(int color) {
-    if (color < 0) return; // default
-    char seq[INLINE_ESCAPECODE_MAXLENGTH];
+/** Formats an escape sequence to produce a given color; returns the number of bytes written to seq */
+static int inline_formatcolor(int color, char *seq, size_t size) {
+    if (color < 0) return 0; // default
     int n = 0;
 
     if (color < 16) { // ANSI 8 or bright 8
         int base = (color < 8 ? 30 : 90);
-        n = snprintf(seq, sizeof(seq), "\x1b[%dm", base + (color & 7));
+        n = snprintf(seq, size, "\x1b[%dm", base + (color & 7));
     } else if (color <= 255) { // 256-color palette 8–255
-        n = snprintf(seq, sizeof(seq), "\x1b[38;5;%dm", color);
+        n = snprintf(seq, size, "\x1b[38;5;%dm", color);
     } else { // Assume RGB packed as 0x01RRGGBB
         int r = (color >> 16) & 0xFF;
         int g = (color >> 8)  & 0xFF;
         int b = (color >> 0)  & 0xFF;
-        n = snprintf(seq, sizeof(seq), "\x1b[38;2;%d;%d;%dm", r, g, b);
+        n = snprintf(seq, size, "\x1b[38;2;%d;%d;%dm", r, g, b);
     }
 
-    if (n > 0) write(STDOUT_FILENO, seq, n);
+    return (n > 0 && (size_t) n < size ? n : 0);
 }
 
-/** Clip grapheme range [*g_start, *g_end) horizontally based on viewport */
-static inline void inline_clipgraphemerange(inline_editor *edit, int line_start, int *g_start, int *g_end) {
-    inline_widthfn width_fn = (edit->width_fn ? edit->width_fn : inline_graphemewidth);
+/** Writes an escape sequence to produce a given color */
+void inline_emitcolor(int color) {
+    char seq[INLINE_ESCAPECODE_MAXLENGTH];
+    int n = inline_formatcolor(color, seq, sizeof(seq));
+    if (n > 0) INLINE_WRITE(STDOUT_FILENO, seq, n);
+}
 
-    int start_col = edit->viewport.first_visible_col;
-    int end_col   = start_col + edit->viewport.screen_cols;
+/* ----------------------------------------
+ * Output buffer
+ * ---------------------------------------- */
 
-    int col = inline_graphemerangewidth(edit, line_start, *g_start);
-    int start = -1;
-    int end   = *g_start;
+/** Write bytes to the terminal, using as few calls as possible */
+static void inline_writeterminal(inline_editor *edit, const char *bytes, size_t nbytes) {
+    const char *p = bytes;
+    size_t remaining = nbytes;
 
-    for (int i = *g_start; i < *g_end; i++) {
-        size_t s, e;
-        inline_graphemerange(edit, i, &s, &e);
-        int w = width_fn(edit->buffer + s, e - s);
+#ifdef _WIN32
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    bool console = GetConsoleMode(hOut, &mode);
+#endif
 
-        if ((col >= start_col) && (col < end_col)) {
-            if (start < 0) start = i; // First visible grapheme
-            end = i + 1; // extend visible range
-        }
+    while (remaining > 0) {
+        int n;
+#ifdef _WIN32
+        DWORD nwritten = 0;
+        if (console) n = (WriteConsoleA(hOut, p, (DWORD) remaining, &nwritten, NULL) ? (int) nwritten : -1);
+        else
+#endif
+        n = (int) INLINE_WRITE(STDOUT_FILENO, p, (unsigned int) remaining);
+        edit->frame_writes++;
+        INLINE_STAT(edit, writes);
+
+        if (n < 0 && errno == EINTR) continue; // Interrupted by a signal, e.g. SIGWINCH
+        if (n <= 0) break; // Give up on error
+        p += n;
+        remaining -= (size_t) n;
+        edit->frame_bytes += (size_t) n;
+        INLINE_STAT_ADD(edit, bytes_written, n);
+    }
+}
+
+/** Write out the contents of the output buffer */
+static void inline_flush(inline_editor *edit) {
+    if (edit->output_len > 0) inline_writeterminal(edit, edit->output, edit->output_len);
+    edit->output_len = 0;
+}
+
+/** Ensure the output buffer can grow by at least `extra` bytes. */
+static bool inline_extendoutputby(inline_editor *edit, size_t extra) {
+    if (extra > SIZE_MAX - edit->output_len) return false; // Prevent overflow
+    size_t required = edit->output_len + extra;
+    if (required <= edit->output_size) return true; // Sufficient space already
+
+    size_t newsize = edit->output_size ? edit->output_size : INLINE_DEFAULT_OUTPUT_SIZE;
+    while (newsize < required) {
+        if (newsize > SIZE_MAX / 2) return false;
+        newsize *= 2; // Grow exponentially
+    }
+
+    char *new = inline_realloc(edit, edit->output, newsize);
+    if (!new) return false;
+    edit->output = new;
+    edit->output_size = newsize;
+    return true;
+}
+
+/** Append bytes to the output buffer; if the buffer cannot grow, the frame is written out early */
+static void inline_write(inline_editor *edit, const char *bytes, size_t nbytes) {
+    if (!inline_extendoutputby(edit, nbytes)) {
+        inline_flush(edit); // Write out what we have and fall back to writing directly
+        inline_writeterminal(edit, bytes, nbytes);
+        edit->frame_valid = false; // Output already written can no longer be discarded
+        edit->output_fallback = true;
+        return;
+    }
+
+    memcpy(edit->output + edit->output_len, bytes, nbytes);
+    edit->output_len += nbytes;
+}
+
+/** Append a string to the output buffer */
+static void inline_writestr(inline_editor *edit, const char *str) {
+    inline_write(edit, str, strlen(str));
+}
+
+/** Append a string literal, such as one of the TERM_ escape sequences, whose length is known at compile time */
+#define inline_writeliteral(edit, str) inline_write(edit, str, sizeof(str) - 1)
+
+/** Append the pre-formatted escape sequence for a palette entry to the output buffer */
+static void inline_writepalettecolor(inline_editor *edit, int index) {
+    int start = (index > 0 ? edit->palette_sgr_end[index - 1] : 0);
+    inline_write(edit, edit->palette_sgr + start, (size_t) (edit->palette_sgr_end[index] - start));
+}
+
+/** Begin a new frame, resetting the frame statistics */
+static void inline_beginframe(inline_editor *edit) {
+    edit->frame_bytes = 0;
+    edit->frame_writes = 0;
+}
+
+/** API function to report the output generated by the last frame */
+void inline_getframestats(inline_editor *edit, size_t *bytes, int *writes) {
+    if (bytes) *bytes = edit->frame_bytes;
+    if (writes) *writes = edit->frame_writes;
+}
+
+/* ----------------------------------------
+ * Statistics
+ * ---------------------------------------- */
+
+#ifdef INLINE_ENABLE_STATS
+/** Monotonic clock in nanoseconds, for measuring latency */
+static uint64_t inline_nowns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    if (!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (uint64_t) (count.QuadPart / frequency.QuadPart) * 1000000000u +
+           (uint64_t) (count.QuadPart % frequency.QuadPart) * 1000000000u / (uint64_t) frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+#endif
+
+/** Reset the counters as a line begins */
+static void inline_resetstats(inline_editor *edit) {
+#ifdef INLINE_ENABLE_STATS
+    memset(&edit->stats, 0, sizeof(edit->stats));
+    edit->keypress_ns = 0;
+#else
+    (void) edit;
+#endif
+}
+
+/** Count a frame, record the latency of any keypresses it shows and call the frame hook */
+static void inline_endframe(inline_editor *edit) {
+#ifdef INLINE_ENABLE_STATS
+    edit->stats.redraws++;
+    if (edit->keypress_ns) {
+        uint64_t latency = inline_nowns() - edit->keypress_ns;
+        edit->stats.latency_count++;
+        edit->stats.latency_total_ns += latency;
+        if (latency > edit->stats.latency_max_ns) edit->stats.latency_max_ns = latency;
+        edit->keypress_ns = 0;
+    }
+    if (edit->frame_fn) edit->frame_fn(edit, &edit->stats, edit->frame_ref);
+#else
+    if (edit->frame_fn) edit->frame_fn(edit, NULL, edit->frame_ref);
+#endif
+}
+
+/** API function to obtain the counters for the line being read, or the line last read */
+bool inline_getstats(inline_editor *edit, inline_stats_t *stats) {
+    if (!stats) return false;
+#ifdef INLINE_ENABLE_STATS
+    if (edit) {
+        *stats = edit->stats;
+        return true;
+    }
+#else
+    (void) edit;
+#endif
+    memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+/** API function to install a hook called at the end of every redraw */
+void inline_setframehook(inline_editor *edit, inline_framefn fn, void *ref) {
+    edit->frame_fn = fn;
+    edit->frame_ref = ref;
+}
+
+/* ----------------------------------------
+ * Display
+ * ---------------------------------------- */
+
+/** FNV-1a hash of a sequence of bytes */
+static uint64_t inline_hash(const char *bytes, size_t nbytes) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < nbytes; i++) {
+        h ^= (unsigned char) bytes[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+/** Ensure the shadow of the previous frame can hold at least `rows` rows */
+static bool inline_extendrowhashes(inline_editor *edit, int rows) {
+    if (rows <= edit->row_hashes_count) return true;
+
+    int newcount = (edit->row_hashes_count ? edit->row_hashes_count : 8);
+    while (newcount < rows) {
+        if (newcount > INT_MAX / 2) return false;
+        newcount *= 2;
+    }
+
+    uint64_t *new = inline_realloc(edit, edit->row_hashes, sizeof(uint64_t) * newcount);
+    if (!new) return false;
+    edit->row_hashes = new;
+    edit->row_hashes_count = newcount;
+    return true;
+}
 
-        if (col + w > end_col) break;
-        col += w;
+/** Find the first grapheme in [lo, hi) of a single line whose column is >= col */
+static int inline_findcolumn(inline_editor *edit, int lo, int hi, int col) {
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (edit->columns[mid] < col) lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
+}
+
+/** Clip grapheme range [*g_start, *g_end) horizontally based on viewport; the range must lie within a single line */
+static inline void inline_clipgraphemerange(inline_editor *edit, int line_start, int *g_start, int *g_end) {
+    (void) line_start; // Columns are already relative to the line start
+
+    int start_col = edit->viewport.first_visible_col;
+    int end_col   = start_col + edit->viewport.screen_cols;
 
-    if (start < 0) start = *g_end; // Clamp if line is empty or viewport is beyond end
-    if (end < start) end = start;
-    else if (end > start && edit->buffer[edit->graphemes[end-1]] == '\n') end--;
+    // Visible graphemes are those that begin within [start_col, end_col)
+    int start = inline_findcolumn(edit, *g_start, *g_end, start_col);
+    int end   = inline_findcolumn(edit, start, *g_end, end_col);
+
+    if (end > start && inline_textbyte(edit, edit->graphemes[end-1]) == '\n') end--;
 
     *g_start = start;
     *g_end   = end;
 }
 
-/** Move terminal cursor to the editor's origin */
-static inline void inline_movetoorigin(inline_editor *edit) {
-    write(STDOUT_FILENO, "\r", 1); // Move to start of current line
-
-    if (edit->term_cursor_row > 0) { // Move up cursor_row lines
-        char seq[INLINE_ESCAPECODE_MAXLENGTH];
-        int n = snprintf(seq, sizeof(seq), "\x1b[%dA", edit->term_cursor_row);
-        write(STDOUT_FILENO, seq, n);
+/** Move terminal cursor to the start of a given row of the editing window, creating rows as needed */
+static void inline_movetorow(inline_editor *edit, int row) {
+    char seq[INLINE_ESCAPECODE_MAXLENGTH];
+    int current = edit->term_cursor_row;
+    int last = imax(edit->term_lines_drawn - 1, current); // Last row known to exist on the terminal
+
+    inline_write(edit, "\r", 1); // Move to start of current line
+
+    if (row < current) { // Move up
+        int n = snprintf(seq, sizeof(seq), "\x1b[%dA", current - row);
+        inline_write(edit, seq, n);
+    } else if (row > current) {
+        int down = imin(row, last) - current; // Move down over existing rows without scrolling
+        if (down > 0) {
+            int n = snprintf(seq, sizeof(seq), "\x1b[%dB", down);
+            inline_write(edit, seq, n);
+        }
+        for (int i = last; i < row; i++) inline_write(edit, "\n", 1); // Create new rows, scrolling if necessary
     }
 }
 
 /** Move the cursor by a specified delta; down is positive dy */
-static inline void inline_moveby(int dx, int dy) {
+static inline void inline_moveby(inline_editor *edit, int dx, int dy) {
     char seq[INLINE_ESCAPECODE_MAXLENGTH];
 
     if (dy<0) { // Up
         int n = snprintf(seq, sizeof(seq), "\x1b[%dA", abs(dy));
-        write(STDOUT_FILENO, seq, n);
+        inline_write(edit, seq, n);
     } else {
-        for (int i = 0; i < dy; i++) inline_emit("\n"); // Ensure scroll
+        for (int i = 0; i < dy; i++) inline_write(edit, "\n", 1); // Ensure scroll
     }
 
     if (dx!=0) { // Horizontal
         int n = snprintf(seq, sizeof(seq), "\x1b[%d%c", abs(dx), (dx < 0 ? 'D' : 'C'));
-        write(STDOUT_FILENO, seq, n);
+        inline_write(edit, seq, n);
     }
 }
 
 /** Render a single line of text
  * @param[in] - edit        - the editor
  * @param[in] - prompt      - prompt for this line
- * @param[in] - byte_start  - byte offset for the start of the line
- * @param[in] - byte_end    - byte offset for the end of the line
+ * @param[in] - prompt_width - display width of the prompt
+ * @param[in] - line        - index of the line
  * @param[in] - logical_cursor_col - column the cursor should be displayed in logical coordinates, or -1 if not on this line
  * @param[in] - is_last     - whether this is the last line
  * @param[out] - rendered_cursor_col - if logical_cursor_col indicates the cursor is on this line,
  *                                     set to logical column the cursor should be rendered on, incuding clipping
  *                                     and prompt widt, or -1 if outside clipping window; otherwise not changed. */
-static void inline_renderline(inline_editor *edit, const char *prompt, size_t byte_start, size_t byte_end,
+static void inline_renderline(inline_editor *edit, const char *prompt, int prompt_width, int line,
                                int logical_cursor_col, bool is_last, int *rendered_cursor_col) {
-    write(STDOUT_FILENO, prompt, (unsigned int) strlen(prompt)); // Write prompt
-    int prompt_width = 0; // Calculate its display width
-    if (!inline_stringwidth(edit, prompt, &prompt_width)) prompt_width = 0;
+    inline_writestr(edit, prompt); // Write prompt
 
     int rendered_width = prompt_width; // Track rendered width
     int rendered_cursor_posn = -1;
@@ -1326,40 +3729,44 @@ static void inline_renderline(inline_editor *edit, const char *prompt, size_t by
     }
 
     // Compute grapheme range for this line; remember the true start of the line
-    int line_start = inline_findgraphemeindex(edit, byte_start);
-    int g_start = line_start, g_end = inline_findgraphemeindex(edit, byte_end);
+    size_t byte_start = edit->lines[line], byte_end = edit->lines[line+1];
+    int line_start = edit->line_graphemes[line];
+    int g_start = line_start, g_end = edit->line_graphemes[line+1];
 
     // Apply horizontal clipping
     inline_clipgraphemerange(edit, line_start, &g_start, &g_end);
 
-    int current_color = -1;
+    int current_color = -1, current_index = -1; // Color shown and the palette entry it came from
     bool selection_on = false; // Track the terminal inverse video state
 
     // Render syntax-colored, clipped graphemes
     int g = g_start;
     size_t off = edit->graphemes[g_start];
 
-    inline_syntaxcolorfn syntax_fn = (edit->palette_count>0 ? edit->syntax_fn : NULL);
-    inline_widthfn width_fn = (edit->width_fn ? edit->width_fn : inline_graphemewidth);
+    bool syntax = (edit->palette_count>0 && inline_hassyntax(edit)); // Spans are read from the line syntax cache
 
     // Render syntax-colored, clipped graphemes
     while (g < g_end && off < byte_end) {
         // Compute color span from current point
         inline_colorspan_t span = { .byte_end = off + 1, .color = 0 };
         bool ok=false;
-        if (syntax_fn) ok=syntax_fn(edit->buffer, edit->syntax_ref, off, &span);
+        if (syntax) ok=inline_linespan(edit, byte_start, off, &span);
         if (!ok || span.byte_end <= off) span.byte_end = byte_end;   // treat rest of line as uncolored
 
-        int span_color = (span.color>=0 && span.color < edit->palette_count ? edit->palette[span.color] : -1);
+        int span_index = (span.color>=0 && span.color < edit->palette_count ? span.color : -1);
+        int span_color = (span_index >= 0 ? edit->palette[span_index] : -1);
 
         // Change color only if needed
         if (span_color != current_color) {
-            if (current_color != -1) {
-                inline_emit(TERM_RESETCOLOR);
+            if (edit->reset_foreground) { // A new foreground color replaces the old one; other attributes are kept
+                if (span_color < 0) inline_writeliteral(edit, TERM_RESETFOREGROUND);
+            } else if (current_color != -1) {
+                inline_writeliteral(edit, TERM_RESETCOLOR);
                 selection_on = false;
             }
-            if (span_color >= 0) inline_emitcolor(span_color);
+            if (span_color >= 0) inline_writepalettecolor(edit, span_index);
             current_color = span_color;
+            current_index = span_index;
         }
 
         // Print graphemes until we reach span.byte_end (clipped)
@@ -1371,29 +3778,31 @@ static void inline_renderline(inline_editor *edit, const char *prompt, size_t by
 
             bool in_selection = (g >= sel_l && g < sel_r); // Are we in a selection?
             if (in_selection != selection_on) {            // Does terminal state match?
-                if (in_selection) inline_emit(TERM_INVERSEVIDEO); // Start reverse video
+                if (in_selection) inline_writeliteral(edit, TERM_INVERSEVIDEO); // Start reverse video
+                else if (edit->reset_foreground) inline_writeliteral(edit, TERM_INVERSEVIDEOOFF);
                 else {
-                    inline_emit(TERM_RESETCOLOR);
-                    if (current_color >= 0) inline_emitcolor(current_color); // Reapply syntax color
+                    inline_writeliteral(edit, TERM_RESETCOLOR);
+                    if (current_index >= 0) inline_writepalettecolor(edit, current_index); // Reapply syntax color
                 }
                 selection_on = in_selection;
             }
 
-            if (edit->buffer[gs] == '\n') break;
+            const char *gp = inline_textptr(edit, gs);
+            if (*gp == '\n') break;
 
             if (logical_cursor_col >= 0 &&  // Check if this grapheme was where the cursor is
                 line_start + logical_cursor_col == g) rendered_cursor_posn = rendered_width;
 
-            if (edit->buffer[gs] == '\t') {
-                for (int i=0; i<INLINE_TAB_WIDTH; i++) inline_emit(" ");
-            } else write(STDOUT_FILENO, edit->buffer + gs, (unsigned int) (ge - gs));
-            rendered_width += width_fn(edit->buffer + gs, ge - gs);
+            if (*gp == '\t') {
+                for (int i=0; i<INLINE_TAB_WIDTH; i++) inline_write(edit, " ", 1);
+            } else inline_write(edit, gp, ge - gs);
+            rendered_width += edit->widths[g];
         }
 
         off = span.byte_end;
     }
 
-    if (selection_on || current_color != -1) inline_emit(TERM_RESETCOLOR);
+    if (selection_on || current_color != -1) inline_writeliteral(edit, TERM_RESETCOLOR);
 
     // Ghosted suggestion suffix (only if at right edge on last line)
     if (is_last && g_end == edit->grapheme_count && logical_cursor_col >= 0) {
@@ -1408,9 +3817,9 @@ static void inline_renderline(inline_editor *edit, const char *prompt, size_t by
 
             if (ghost_width <= remaining_cols) { // Show suggestion as faint text
                 edit->suggestion_shown=true;
-                inline_emit(TERM_FAINT);
-                write(STDOUT_FILENO, suffix, (unsigned int) strlen(suffix));
-                inline_emit(TERM_RESETCOLOR);
+                inline_writeliteral(edit, TERM_FAINT);
+                inline_writestr(edit, suffix);
+                inline_writeliteral(edit, TERM_RESETCOLOR);
             }
         }
     }
@@ -1420,45 +3829,79 @@ static void inline_renderline(inline_editor *edit, const char *prompt, size_t by
         else *rendered_cursor_col = rendered_width; // cursor at end
     }
 
-    if (rendered_width < edit->viewport.screen_cols) inline_emit(TERM_CLEAR); // Clear to end of line
+    if (rendered_width < edit->viewport.screen_cols) inline_writeliteral(edit, TERM_CLEAR); // Clear to end of line
 }
 
-/** Redraw the entire buffer in multiline mode */
-static void inline_redraw(inline_editor *edit) {
-    inline_emit(TERM_HIDECURSOR); // Prevent flickering
-    inline_movetoorigin(edit);
+/** Redraw the buffer in multiline mode.
+ *  @details Each row is rendered into the output buffer and hashed; rows whose output matches what the
+ *           previous frame drew are discarded, so only changed rows are written to the terminal. */
+static void inline_drawframe(inline_editor *edit) {
+    inline_beginframe(edit);
+    edit->output_fallback = false;
+    inline_writeliteral(edit, TERM_HIDECURSOR); // Prevent flickering; discarded if no rows are repainted
 
     int cursor_row, cursor_col; // Compute logical cursor column and row (pre-clipping)
     inline_cursorposn(edit, &cursor_row, &cursor_col);
+    inline_scrolltorow(edit, cursor_row); // The buffer may have shrunk or the terminal resized since the cursor moved
 
-    int rendered_cursor_col = -1;  // To be filled out by inline_renderline
-    for (int i = 0; i < edit->line_count; i++) {
-        size_t byte_start = edit->lines[i]; // Render lines
-        size_t byte_end   = edit->lines[i+1];
-        bool is_last = (i == edit->line_count - 1);
+    int first = edit->viewport.first_visible_line; // Only lines within the viewport are rendered
+    int visible = imin(edit->line_count - first, edit->viewport.screen_rows);
+    if (edit->palette_count>0) inline_updatelinesyntax(edit, first + visible);
+
+    int rows = imax(visible, edit->term_lines_drawn); // Clear rows left over from the last frame
+    bool shadow = inline_extendrowhashes(edit, rows);
+    if (!shadow) edit->frame_valid = false;
 
-        inline_emit("\r");        // Move cursor to start of line
+    int rendered_cursor_col = -1;  // To be filled out by inline_renderline
+    int dirty = 0;                 // Number of rows repainted
+    for (int i = 0; i < rows; i++) {
+        size_t mark = edit->output_len;
+        inline_movetorow(edit, i);
+        size_t row_start = edit->output_len;
+
+        if (i < visible) {
+            int line = first + i, prompt_width;
+            const char *prompt = inline_lineprompt(edit, line, &prompt_width);
+            inline_renderline(edit, prompt, prompt_width, line,
+                              (cursor_row == line ? cursor_col : -1), // cursor column if on this line
+                              (line == edit->line_count - 1), // whether we're on the last line or not
+                              &rendered_cursor_col );
+        } else inline_writeliteral(edit, TERM_CLEAR);
+
+        if (!edit->output_fallback) { // Offsets are meaningless once output has been written out directly
+            uint64_t h = inline_hash(edit->output + row_start, edit->output_len - row_start);
+            if (edit->frame_valid && i < edit->term_lines_drawn && edit->row_hashes[i] == h) {
+                edit->output_len = mark; // Row is unchanged, so discard its output
+                continue;
+            }
+            if (shadow) edit->row_hashes[i] = h;
+        }
 
-        inline_renderline(edit, (i==0 ? edit->prompt : edit->continuation_prompt), // prompt
-                          byte_start, byte_end,
-                          (cursor_row == i ? cursor_col : -1), // cursor column if on this line
-                          is_last, // whether we're on the last line or not
-                          &rendered_cursor_col );
-                          
-        if (i + 1 < edit->line_count) inline_emit("\n"); // Move to next line if not at end
+        edit->term_cursor_row = i; // Record where the terminal cursor now is
+        if (i >= edit->term_lines_drawn) edit->term_lines_drawn = i + 1;
+        dirty++;
     }
 
-    int extra = (edit->term_lines_drawn > edit->line_count ? edit->term_lines_drawn - edit->line_count : 0);
-    for (int i = 0; i < extra; i++) {
-        inline_emit("\n\r");
-        inline_emit(TERM_CLEAR);
+    int screen_row = cursor_row - first; // Row of the cursor within the editing window
+    if (!dirty) { // Nothing was repainted
+        edit->output_len = 0;
+        if (screen_row == edit->term_cursor_row && rendered_cursor_col == edit->term_cursor_col) return;
     }
 
-    write(STDOUT_FILENO, "\r", 1); // Move to start of line
-    inline_moveby(rendered_cursor_col, cursor_row - edit->line_count - extra + 1);
-    edit->term_cursor_row = cursor_row; // Record cursor row
-    edit->term_lines_drawn = edit->line_count; // Record no. of lines drawn
-    inline_emit(TERM_SHOWCURSOR);
+    inline_movetorow(edit, screen_row); // Position the cursor
+    inline_moveby(edit, rendered_cursor_col, 0);
+    edit->term_cursor_row = screen_row; // Record cursor position
+    edit->term_cursor_col = rendered_cursor_col;
+    edit->frame_valid = shadow && !edit->output_fallback; // Rows drawn piecemeal must be repainted next frame
+
+    if (dirty) inline_writeliteral(edit, TERM_SHOWCURSOR);
+    inline_flush(edit); // Write the whole frame at once
+}
+
+/** Redraw the editing window */
+static void inline_redraw(inline_editor *edit) {
+    inline_drawframe(edit);
+    inline_endframe(edit);
 }
   
 /** API function to print a syntax colored string */
@@ -1467,24 +3910,25 @@ void inline_displaywithsyntaxcoloring(inline_editor *edit, const char *string) {
     fflush(stdout);
     size_t len = strlen(string);
 
-    if (!edit->syntax_fn || !edit->palette_count) { // Syntax highlighting not configured, fallback to plain
-        write(STDOUT_FILENO, string, (unsigned int) len);
+    if ((!edit->syntax_fn && !edit->incremental_syntax_fn) || !edit->palette_count) { // Syntax highlighting not configured, fallback to plain
+        inline_beginframe(edit);
+        inline_writeterminal(edit, string, len);
         return;
     }
 
     inline_reset(edit);
     edit->viewport.screen_cols=INT_MAX;
     inline_insert(edit, string, len);
-    inline_recomputegraphemes(edit);
-    inline_recomputelines(edit);
+    inline_updatelinesyntax(edit, edit->line_count);
 
+    inline_beginframe(edit);
     for (int i = 0; i < edit->line_count; i++) {
-        size_t byte_start = edit->lines[i], byte_end = edit->lines[i+1];
         bool is_last = (i == edit->line_count - 1);
-        inline_renderline(edit, "", byte_start, byte_end, -1, is_last, NULL );
-        if (i + 1 < edit->line_count) inline_emit("\n\r"); // Move to next line if not at end
+        inline_renderline(edit, "", 0, i, -1, is_last, NULL );
+        if (i + 1 < edit->line_count) inline_writestr(edit, "\n\r"); // Move to next line if not at end
     }
 
+    inline_flush(edit);
     inline_clear(edit);
     fflush(stdout);
 }
@@ -1501,27 +3945,6 @@ void inline_displaywithsyntaxcoloring(inline_editor *edit, const char *string) {
 typedef unsigned char rawinput_t;
 
 #ifdef _WIN32
-static bool inline_readkeyevent(KEY_EVENT_RECORD *k) {
-    INPUT_RECORD rec;
-    DWORD nread;
-    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
-
-    for (;;) {
-        if (!ReadConsoleInputW(hIn, &rec, 1, &nread)) return false;
-
-        if (rec.EventType == WINDOW_BUFFER_SIZE_EVENT) {
-            resize_pending = 1;
-            if (inline_lasteditor) inline_lasteditor->refresh = true;
-            continue;
-        }
-
-        if (rec.EventType == KEY_EVENT && rec.Event.KeyEvent.bKeyDown) {
-            *k = rec.Event.KeyEvent;
-            return true;
-        }
-    }
-}
-
 /** Helper to emit an escape sequence */
 static int _emitstr(const char *s, unsigned char out[8]) {
     int n = 0;
@@ -1538,7 +3961,7 @@ typedef struct {
 static const vkmap_t vk_table[] = {
     { VK_RETURN, "\n"     },
     { VK_BACK,   "\b"     },
-    { VK_DELETE, "\x7f"   },
+    { VK_DELETE, "\x1b[3~" },
     { VK_UP,     "\x1b[A" },
     { VK_DOWN,   "\x1b[B" },
     { VK_RIGHT,  "\x1b[C" },
@@ -1550,14 +3973,20 @@ static const vkmap_t vk_table[] = {
 };
 
 /** Convert windows keypress event to POSIX */
-static int inline_translatekeypress(const KEY_EVENT_RECORD *k, unsigned char out[8]) {
+static int inline_translatekeypress(inline_editor *edit, const KEY_EVENT_RECORD *k, unsigned char out[8]) {
     WORD vk = k->wVirtualKeyCode;
     WCHAR wc = k->uChar.UnicodeChar;
     DWORD mods = k->dwControlKeyState;
 
-    // Shift-arrows
-    if ((mods & SHIFT_PRESSED) && (vk == VK_LEFT || vk == VK_RIGHT)) {
-        return _emitstr( (vk == VK_LEFT ? "\x1b[1;2D" : "\x1b[1;2C"), out );
+    // Modified arrows, Home and End use the xterm form ESC [ 1 ; m X, where m-1 has bits for Shift, Alt and Ctrl
+    bool ctrl = (mods & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)), alt = (mods & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED));
+    int m = 1 + ((mods & SHIFT_PRESSED) ? 1 : 0) + (alt ? 2 : 0) + (ctrl ? 4 : 0);
+    const char *finals = "ABCDHF";
+    const WORD cursorkeys[] = { VK_UP, VK_DOWN, VK_RIGHT, VK_LEFT, VK_HOME, VK_END };
+    for (int j = 0; m > 1 && j < 6; j++) {
+        if (vk != cursorkeys[j]) continue;
+        char seq[8] = { '\x1b', '[', '1', ';', (char) ('0' + m), finals[j], '\0' };
+        return _emitstr(seq, out);
     }
 
     // Search table of mappings
@@ -1575,68 +4004,195 @@ static int inline_translatekeypress(const KEY_EVENT_RECORD *k, unsigned char out
 
     // Alt characters
     int i=0; 
+    if (wc >= 0xD800 && wc <= 0xDBFF) { // High surrogate: hold until the low surrogate arrives in a later record
+        edit->pending_surrogate = wc;
+        return 0;
+    }
+
     if (mods & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) {
         out[i++] = '\x1b'; // Prefix character with esc
     }
 
-    if (wc != 0) { // Unicode
+    if (wc >= 0xDC00 && wc <= 0xDFFF) { // Low surrogate
+        WCHAR wc1 = edit->pending_surrogate;
+        edit->pending_surrogate = 0;
+        if (!wc1) return 0; // Unpaired
+
+        uint32_t cp = 0x10000 + (((wc1 - 0xD800) << 10) | (wc - 0xDC00));
+        out[i++] = (unsigned char) (0xF0 | (cp >> 18));
+        out[i++] = (unsigned char) (0x80 | ((cp >> 12) & 0x3F));
+        out[i++] = (unsigned char) (0x80 | ((cp >> 6) & 0x3F));
+        out[i++] = (unsigned char) (0x80 | (cp & 0x3F));
+    } else if (wc != 0) { // Unicode
         if (wc < 0x80) {
             out[i++] = (unsigned char)wc;
         } else if (wc < 0x800) {
             out[i++] = (unsigned char)(0xC0 | ((unsigned int)wc >> 6));
             out[i++] = (unsigned char)(0x80 | ((unsigned int)wc & 0x3F));
-        } else if (wc < 0xD800 || wc > 0xDFFF) {
+        } else {
             out[i++] = 0xE0 | (wc >> 12);
             out[i++] = 0x80 | ((wc >> 6) & 0x3F);
             out[i++] = 0x80 | (wc & 0x3F);
-        } else if (wc >= 0xD800 && wc <= 0xDBFF) { // high surrogate
-            // Need the next KEY_EVENT for the low surrogate
-            KEY_EVENT_RECORD next;
-            if (!inline_readkeyevent(&next)) return 0;
-
-            WCHAR wc2 = next.uChar.UnicodeChar;
-            if (wc2 >= 0xDC00 && wc2 <= 0xDFFF) {
-                uint32_t cp = 0x10000 + (((wc - 0xD800) << 10) | (wc2 - 0xDC00));
-                out[i++] = (unsigned char) (0xF0 | (cp >> 18));
-                out[i++] = (unsigned char) (0x80 | ((cp >> 12) & 0x3F));
-                out[i++] = (unsigned char) (0x80 | ((cp >> 6) & 0x3F));
-                out[i++] = (unsigned char) (0x80 | (cp & 0x3F));
-            }
         }
     }
 
     return i; // Return 
 }
 
-#endif
+#endif
+
+/** Refill the input buffer with all input currently available, waiting for at least one byte; the keypress
+ *  inline_poll is decoding is kept, as it may have to be held until the rest of it arrives */
+static bool inline_fillinput(inline_editor *edit) {
+    int keep = (edit->input_mark != INLINE_INVALID ? edit->input_mark : edit->input_pos);
+    memmove(edit->input, edit->input + keep, (size_t) (edit->input_len - keep));
+    edit->input_len -= keep;
+    edit->input_pos -= keep;
+    if (edit->input_mark != INLINE_INVALID) edit->input_mark = 0;
+    int start = edit->input_len;
+
+#ifdef _WIN32
+    INPUT_RECORD recs[INLINE_INPUT_RECORDS];
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+
+    while (edit->input_len == start) {
+        DWORD nread, space = (DWORD) (sizeof(edit->input) - (size_t) edit->input_len) / 8; // Records that fit
+        if (!space || !ReadConsoleInputW(hIn, recs, (space < INLINE_INPUT_RECORDS ? space : INLINE_INPUT_RECORDS), &nread)) return false;
+
+        for (DWORD i = 0; i < nread; i++) {
+            if (recs[i].EventType == WINDOW_BUFFER_SIZE_EVENT) {
+                resize_pending = 1;
+                edit->refresh = true;
+            } else if (recs[i].EventType == KEY_EVENT && recs[i].Event.KeyEvent.bKeyDown) { // Translate to POSIX
+                edit->input_len += inline_translatekeypress(edit, &recs[i].Event.KeyEvent, edit->input + edit->input_len);
+            }
+        }
+    }
+#else
+    ssize_t n;
+    do {
+        n = INLINE_READ(STDIN_FILENO, edit->input + start, sizeof(edit->input) - (size_t) start); // Blocks until at least one byte is available
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    edit->input_len += (int) n;
+#endif
+    return true;
+}
+
+/** Await a single raw unit of input and store in a rawinput_t */
+static bool inline_readraw(inline_editor *edit, rawinput_t *out) {
+    if (edit->input_pos >= edit->input_len && !inline_fillinput(edit)) return false;
+    *out = edit->input[edit->input_pos++];
+    return true;
+}
+
+#ifdef _WIN32
+/** Check whether a keypress is waiting in the console input queue, discarding events we would ignore */
+static bool inline_consolekeypending(inline_editor *edit, HANDLE hIn) {
+    for (;;) {
+        DWORD n = 0;
+        INPUT_RECORD rec;
+        if (!GetNumberOfConsoleInputEvents(hIn, &n) || n == 0) return false;
+        if (!PeekConsoleInputW(hIn, &rec, 1, &n) || n == 0) return false;
+        if (rec.EventType == KEY_EVENT && rec.Event.KeyEvent.bKeyDown) return true;
+
+        if (!ReadConsoleInputW(hIn, &rec, 1, &n)) return false; // Consume the event
+        if (rec.EventType == WINDOW_BUFFER_SIZE_EVENT) {
+            resize_pending = 1;
+            edit->refresh = true;
+        }
+    }
+}
+#endif
+
+/** Wait up to timeout ms (0 to poll) for input to become available; returns true if input is pending */
+static bool inline_waitforinput(inline_editor *edit, int timeout) {
+    if (edit->input_pos < edit->input_len) return true; // Already buffered
+
+#ifdef _WIN32
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+    ULONGLONG deadline = GetTickCount64() + (ULONGLONG) timeout;
+    for (;;) {
+        if (inline_consolekeypending(edit, hIn)) return true;
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) return false;
+        if (WaitForSingleObject(hIn, (DWORD) (deadline - now)) != WAIT_OBJECT_0) return false;
+    }
+#else
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    int n;
+    do {
+        n = poll(&pfd, 1, timeout);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+#endif
+}
+
+/** Look at the next raw unit of input without consuming it, waiting up to timeout ms (negative waits indefinitely);
+ *  inline_poll never waits, but notes that the input ran short */
+static bool inline_peekraw(inline_editor *edit, rawinput_t *out, int timeout) {
+    if (edit->input_pos >= edit->input_len) {
+        if (edit->polling) timeout = 0;
+        if (timeout >= 0 && !inline_waitforinput(edit, timeout)) {
+            edit->input_short = true;
+            return false;
+        }
+        if (!inline_fillinput(edit)) return false;
+    }
+    *out = edit->input[edit->input_pos];
+    return true;
+}
+
+/** Monotonic clock in milliseconds */
+static uint64_t inline_now(void) {
+#ifdef _WIN32
+    return (uint64_t) GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000u + (uint64_t) ts.tv_nsec / 1000000u;
+#endif
+}
+
+#define INLINE_EVENT_INPUT  1 // Terminal input is available
+#define INLINE_EVENT_WAKEUP 2 // Another thread signaled the wakeup channel
 
-/** Await a single raw unit of input and store in a rawinput_t */
-static bool inline_readraw(rawinput_t *out) {
+/** Wait up to timeout ms (negative to wait indefinitely) for terminal input or a wakeup;
+ *  returns a mask of INLINE_EVENT_ flags, zero on timeout or -1 on error */
+static int inline_waitforevents(inline_editor *edit, int timeout) {
 #ifdef _WIN32
-    static unsigned char buf[16]; // local ring buffer
-    static int len = 0;
-    static int pos = 0;
+    HANDLE handles[2] = { GetStdHandle(STD_INPUT_HANDLE), edit->wakeup };
+    ULONGLONG deadline = GetTickCount64() + (ULONGLONG) (timeout < 0 ? 0 : timeout);
+    for (;;) {
+        DWORD wait = INFINITE;
+        if (timeout >= 0) {
+            ULONGLONG now = GetTickCount64();
+            wait = (DWORD) (deadline > now ? deadline - now : 0);
+        }
 
-    if (pos < len) { // Return remaining bytes
-        *out = buf[pos++];
-        return true;
+        DWORD r = WaitForMultipleObjects(2, handles, FALSE, wait);
+        if (r == WAIT_OBJECT_0 + 1) return INLINE_EVENT_WAKEUP;
+        if (r == WAIT_TIMEOUT) return 0;
+        if (r != WAIT_OBJECT_0) return -1;
+        if (inline_consolekeypending(edit, handles[0])) return INLINE_EVENT_INPUT; // Otherwise only ignored events were queued
     }
-
-    KEY_EVENT_RECORD k; // Get new key event
+#else
+    struct pollfd pfd[2] = { { .fd = STDIN_FILENO, .events = POLLIN }, { .fd = edit->wakeup[0], .events = POLLIN } };
+    int n;
     do {
-        if (!inline_readkeyevent(&k)) return false;
-        len = inline_translatekeypress(&k, buf); // Translate it to POSIX
-        pos = 0;
-    } while (len == 0);
+        n = poll(pfd, 2, timeout);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return -1;
 
-    *out = buf[pos++]; // Return first byte
-    return true;
-#else
-    int n = (int) read(STDIN_FILENO, out, 1);
-    return n == 1;
+    return ((pfd[0].revents ? INLINE_EVENT_INPUT : 0) | (pfd[1].revents ? INLINE_EVENT_WAKEUP : 0));
 #endif
 }
 
+/** Check whether further input is waiting without blocking */
+static bool inline_inputpending(inline_editor *edit) {
+    return inline_waitforinput(edit, 0);
+}
+
 /* ----------------------------------------
  * Keypress decoding layer
  * ---------------------------------------- */
@@ -1645,11 +4201,16 @@ static bool inline_readraw(rawinput_t *out) {
 typedef enum {
     KEY_UNKNOWN, KEY_CHARACTER,
     KEY_RETURN, KEY_CTRL_RETURN, KEY_TAB, KEY_SHIFT_TAB, KEY_DELETE,
+    KEY_FORWARD_DELETE,              // Delete the grapheme at the cursor
+    KEY_ESCAPE,                      // ESC on its own
     KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT,   // Arrow keys
     KEY_HOME, KEY_END,               // Home and End
     KEY_PAGE_UP, KEY_PAGE_DOWN,      // Page up and page down
     KEY_SHIFT_LEFT, KEY_SHIFT_RIGHT, // Shift+arrow key
-    KEY_CTRL, KEY_ALT                // Ctrl, meta keys
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, // Function keys
+    KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+    KEY_CTRL, KEY_ALT,               // Ctrl, meta keys
+    KEY_PASTE                        // Start of a bracketed paste
 } keytype_t;
 
 /** A single keypress event obtained and processed by the terminal */
@@ -1672,21 +4233,22 @@ static void inline_keypresswithchar(keypress_t *keypress, keytype_t type, char c
 }
 
 /** Decode sequence of characters into a utf8 character */
-static void inline_decodeutf8input(unsigned char first, keypress_t *out) {
+static void inline_decodeutf8input(inline_editor *edit, unsigned char first, keypress_t *out) {
     out->nbytes = inline_utf8length(first);
 
     if (!out->nbytes) return; // Invalid first byte or stray continuation
 
     out->c[0] = first;
     for (int i=1; i<out->nbytes; i++) {
-        if (!inline_readraw(&out->c[i])) { out->c[i] = '\0'; return; }
+        if (!inline_peekraw(edit, &out->c[i], -1)) { out->c[i] = '\0'; return; }
+        edit->input_pos++;
     }
 
     out->c[out->nbytes] = '\0';
     out->type = KEY_CHARACTER;
 }
 
-/** Map from terminal codes to keytype_t  */
+/** Map from terminal codes, without the leading ESC, to keytype_t */
 typedef struct {
     const char *seq;
     keytype_t type;
@@ -1699,40 +4261,169 @@ static const escmap_t esc_table[] = {
     { "[D",    KEY_LEFT },
     { "[H",    KEY_HOME },
     { "[F",    KEY_END },
-    { "[Z",    KEY_SHIFT_TAB },
+    { "OA",    KEY_UP },            // SS3 forms sent in application cursor mode
+    { "OB",    KEY_DOWN },
+    { "OC",    KEY_RIGHT },
+    { "OD",    KEY_LEFT },
+    { "OH",    KEY_HOME },
+    { "OF",    KEY_END },
+    { "[1~",   KEY_HOME },          // Home and End as sent by VT220-style terminals
+    { "[7~",   KEY_HOME },
+    { "[4~",   KEY_END },
+    { "[8~",   KEY_END },
+    { "[3~",   KEY_FORWARD_DELETE },
     { "[5~",   KEY_PAGE_UP },
     { "[6~",   KEY_PAGE_DOWN },
-    { "[1;2C", KEY_SHIFT_RIGHT },
-    { "[1;2D", KEY_SHIFT_LEFT },
+    { "OP",    KEY_F1 },
+    { "OQ",    KEY_F2 },
+    { "OR",    KEY_F3 },
+    { "OS",    KEY_F4 },
+    { "[11~",  KEY_F1 },
+    { "[12~",  KEY_F2 },
+    { "[13~",  KEY_F3 },
+    { "[14~",  KEY_F4 },
+    { "[15~",  KEY_F5 },
+    { "[17~",  KEY_F6 },
+    { "[18~",  KEY_F7 },
+    { "[19~",  KEY_F8 },
+    { "[20~",  KEY_F9 },
+    { "[21~",  KEY_F10 },
+    { "[23~",  KEY_F11 },
+    { "[24~",  KEY_F12 },
+    { "[Z",    KEY_SHIFT_TAB },
+    { "[200~", KEY_PASTE },
 };
 
-static void inline_decode_escape(keypress_t *out) {
-    unsigned char seq[INLINE_ESCAPECODE_MAXLENGTH+1];
-    int i = 0;
-    out->type = KEY_UNKNOWN;
+/* ----------------------------------------
+ * Escape sequence trie
+ * ---------------------------------------- */
 
-    if (!inline_readraw(&seq[i])) return; // Read byte after esc
+/** Find the child of a node that matches a byte, or INLINE_INVALID */
+static int inline_keychild(inline_keytrie_t *trie, int node, unsigned char byte) {
+    for (int n = trie->nodes[node].child; n != INLINE_INVALID; n = trie->nodes[n].sibling) {
+        if (trie->nodes[n].byte == byte) return n;
+    }
+    return INLINE_INVALID;
+}
 
-    if (seq[0] !='[') { // Is this an alt + char combo?
-        inline_decodeutf8input(seq[0], out);
-        out->type=KEY_ALT; // Override type
-        return;
+/** Append a node with no key; returns its index or INLINE_INVALID on allocation failure */
+static int inline_addkeynode(inline_editor *edit, unsigned char byte) {
+    inline_keytrie_t *trie = &edit->keys;
+    if (trie->count >= trie->capacity) {
+        int newcapacity = (trie->capacity ? trie->capacity * 2 : 256);
+        inline_keynode_t *new = inline_realloc(edit, trie->nodes, sizeof(inline_keynode_t) * newcapacity);
+        if (!new) return INLINE_INVALID;
+        trie->nodes = new;
+        trie->capacity = newcapacity;
+    }
+    trie->nodes[trie->count] = (inline_keynode_t) { .child = INLINE_INVALID, .sibling = INLINE_INVALID, .byte = byte, .key = KEY_UNKNOWN };
+    return trie->count++;
+}
+
+/** Add a sequence to the trie, replacing the key of any identical sequence */
+static bool inline_addkeysequence(inline_editor *edit, const char *seq, keytype_t key, unsigned char c) {
+    int node = 0;
+    for (const unsigned char *p = (const unsigned char *) seq; *p; p++) {
+        int next = inline_keychild(&edit->keys, node, *p);
+        if (next == INLINE_INVALID) {
+            next = inline_addkeynode(edit, *p);
+            if (next == INLINE_INVALID) return false;
+            edit->keys.nodes[next].sibling = edit->keys.nodes[node].child; // Link as the first child
+            edit->keys.nodes[node].child = next;
+        }
+        node = next;
     }
+    edit->keys.nodes[node].key = key;
+    edit->keys.nodes[node].c = c;
+    return true;
+}
 
-    // It's an escape code, so read until alpha terminator
-    for (i = 1; i < INLINE_ESCAPECODE_MAXLENGTH - 1; i++) {
-        if (!inline_readraw(&seq[i])) break;
-        if (isalpha(seq[i]) || seq[i] == '~') break;
+/** Add the xterm modified forms of a sequence, ESC [ 1 ; m X for ESC [ X or ESC O X and ESC [ n ; m ~ for ESC [ n ~,
+ *  where m-1 has bits for Shift, Alt and Ctrl. Modifiers other than Shift+arrow have no binding of their own,
+ *  so report the unmodified key. */
+static bool inline_addmodifiedsequences(inline_editor *edit, const char *seq, keytype_t key) {
+    size_t len = strlen(seq);
+    char mod[INLINE_ESCAPECODE_MAXLENGTH];
+    if (len + 3 >= sizeof(mod) || key == KEY_PASTE || key == KEY_SHIFT_TAB) return true;
+
+    for (int m = 2; m <= 8; m++) {
+        if (seq[len - 1] == '~') snprintf(mod, sizeof(mod), "%.*s;%d~", (int) (len - 1), seq, m);
+        else if (len == 2) snprintf(mod, sizeof(mod), "[1;%d%c", m, seq[1]);
+        else return true;
+
+        keytype_t type = key;
+        if (m == 2 && key == KEY_LEFT) type = KEY_SHIFT_LEFT;
+        if (m == 2 && key == KEY_RIGHT) type = KEY_SHIFT_RIGHT;
+        if (!inline_addkeysequence(edit, mod, type, 0)) return false;
     }
-    seq[i + 1] = '\0'; // Ensure null terminated
+    return true;
+}
+
+/** Build the trie of built-in sequences if it does not yet exist */
+static bool inline_buildkeytrie(inline_editor *edit) {
+    if (edit->keys.count) return true;
+    if (inline_addkeynode(edit, 0) == INLINE_INVALID) return false; // Root
 
-    // Lookup escape code
     for (size_t j = 0; j < sizeof(esc_table)/sizeof(esc_table[0]); j++) {
-        if (strcmp((const char *)seq, esc_table[j].seq) == 0) {
-            out->type = esc_table[j].type;
-            return;
+        if (!inline_addkeysequence(edit, esc_table[j].seq, esc_table[j].type, 0) ||
+            !inline_addmodifiedsequences(edit, esc_table[j].seq, esc_table[j].type)) {
+            inline_dealloc(edit, edit->keys.nodes); // Try again on the next escape sequence
+            edit->keys = (inline_keytrie_t) { 0 };
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Consume the remainder of an unrecognized control sequence, up to and including its final byte */
+static void inline_skipcontrolsequence(inline_editor *edit) {
+    rawinput_t b;
+    for (int i = 0; i < INLINE_ESCAPECODE_MAXLENGTH && inline_peekraw(edit, &b, edit->escape_timeout); i++) {
+        edit->input_pos++;
+        if (b >= 0x40 && b <= 0x7E) break; // Final byte
+    }
+}
+
+/** Decode the input following an ESC by following the trie for as long as the input matches it.
+ *  ESC followed by nothing within the timeout is reported on its own; ESC followed by a byte that
+ *  begins no sequence is Alt + that character. */
+static void inline_decode_escape(inline_editor *edit, keypress_t *out) {
+    out->type = KEY_UNKNOWN;
+
+    rawinput_t b;
+    if (!inline_peekraw(edit, &b, edit->escape_timeout)) { out->type = KEY_ESCAPE; return; }
+
+    inline_keytrie_t *trie = &edit->keys;
+    int node = (inline_buildkeytrie(edit) ? inline_keychild(trie, 0, b) : INLINE_INVALID);
+    edit->input_pos++;
+
+    if (node == INLINE_INVALID) { // Is this an alt + char combo?
+        inline_decodeutf8input(edit, b, out);
+        out->type=KEY_ALT; // Override type
+        return;
+    }
+
+    unsigned char first = b;
+    int depth = 1;
+    while (trie->nodes[node].child != INLINE_INVALID && inline_peekraw(edit, &b, edit->escape_timeout)) {
+        int next = inline_keychild(trie, node, b);
+        if (next == INLINE_INVALID) { // Input has left the trie
+            if (trie->nodes[node].key == KEY_UNKNOWN && first == '[') { // Discard the rest of an unrecognized sequence
+                inline_skipcontrolsequence(edit);
+                return;
+            }
+            break;
         }
+        edit->input_pos++;
+        node = next;
+        depth++;
     }
+
+    const inline_keynode_t *n = &trie->nodes[node];
+    if (n->key != KEY_UNKNOWN) {
+        if (n->c) inline_keypresswithchar(out, (keytype_t) n->key, (char) n->c);
+        else out->type = (keytype_t) n->key;
+    } else if (depth == 1) inline_keypresswithchar(out, KEY_ALT, (char) first); // Prefix arrived alone, e.g. Alt+[ or Alt+O
 }
 
 /** Raw control codes produced by POSIX terminals */
@@ -1746,7 +4437,7 @@ enum keycodes {
 };
 
 /** Decode raw input units into a keypress */
-static void inline_decode(const rawinput_t *raw, keypress_t *out) {
+static void inline_decode(inline_editor *edit, const rawinput_t *raw, keypress_t *out) {
     inline_keypressunknown(out); // Initially UNKNOWN
     unsigned char b = *raw;
 
@@ -1758,7 +4449,7 @@ static void inline_decode(const rawinput_t *raw, keypress_t *out) {
             case BACKSPACE_CODE: // v fallthrough
             case DELETE_CODE: out->type = KEY_DELETE; return;
             case ESC_CODE:
-                inline_decode_escape(out);
+                inline_decode_escape(edit, out);
                 return;
 
             default: // Control codes are Ctrl+A → 1, Ctrl+Z → 26
@@ -1772,18 +4463,79 @@ static void inline_decode(const rawinput_t *raw, keypress_t *out) {
         return;
     }
 
-    inline_decodeutf8input(b, out); // UTF8
+    inline_decodeutf8input(edit, b, out); // UTF8
+}
+
+/** Count a keypress in the statistics */
+static void inline_countkeypress(inline_editor *edit) {
+#ifdef INLINE_ENABLE_STATS
+    edit->stats.keypresses++;
+    if (!edit->keypress_ns) edit->keypress_ns = inline_nowns(); // Latency runs from the oldest keypress the next frame shows
+#else
+    (void) edit;
+#endif
 }
 
 /** Obtain a keypress event */
 static bool inline_readkeypress(inline_editor *edit, keypress_t *out) {
-    (void) edit;
     rawinput_t raw;
-    if (!inline_readraw(&raw)) return false;
-    inline_decode(&raw, out);
+    if (!inline_readraw(edit, &raw)) return false;
+    inline_countkeypress(edit);
+    inline_decode(edit, &raw, out);
     return true;
 }
 
+/** Obtain a keypress event from input that has already arrived, for inline_poll. A sequence cut short, such as
+ *  a lone ESC or part of a UTF-8 character, is left buffered and input_due set, until the rest arrives or
+ *  escape_timeout elapses and it is decoded as it stands. Returns false at the end of input or on error. */
+static bool inline_pollkeypress(inline_editor *edit, keypress_t *out) {
+    edit->input_mark = edit->input_pos; // Keep the sequence buffered in case it must be held
+    edit->input_short = false;
+
+    rawinput_t raw;
+    bool success = inline_readraw(edit, &raw);
+    if (success) inline_decode(edit, &raw, out);
+
+    if (success && edit->input_short) {
+        uint64_t now = inline_now();
+        if (!edit->input_due) edit->input_due = (edit->escape_timeout < 0 ? UINT64_MAX : now + (uint64_t) edit->escape_timeout);
+        if (now < edit->input_due) { // Hold the sequence
+            edit->input_pos = edit->input_mark;
+            edit->input_mark = INLINE_INVALID;
+            return true;
+        }
+    }
+
+    edit->input_mark = INLINE_INVALID;
+    edit->input_due = 0;
+    if (success) inline_countkeypress(edit);
+    return success;
+}
+
+/** API function to recognize an additional escape sequence as an existing key.
+ *  @param   seq - the sequence, beginning with ESC.
+ *  @param   as  - a sequence inline already recognizes, or a single ASCII character such as a control code. */
+bool inline_registerkeysequence(inline_editor *edit, const char *seq, const char *as) {
+    if (!edit || !seq || !as || seq[0] != ESC_CODE || !seq[1] || strlen(seq) >= INLINE_ESCAPECODE_MAXLENGTH) return false;
+    if (!inline_buildkeytrie(edit)) return false;
+
+    keypress_t key;
+    inline_keypressunknown(&key);
+    if (as[0] == ESC_CODE) { // Find the key the existing sequence produces
+        int node = 0;
+        for (const unsigned char *p = (const unsigned char *) as + 1; *p && node != INLINE_INVALID; p++) node = inline_keychild(&edit->keys, node, *p);
+        if (node == INLINE_INVALID || node == 0 || edit->keys.nodes[node].key == KEY_UNKNOWN) return false;
+        key.type = (keytype_t) edit->keys.nodes[node].key;
+        key.c[0] = edit->keys.nodes[node].c;
+    } else if ((unsigned char) as[0] < 128 && as[1] == '\0') {
+        rawinput_t raw = (rawinput_t) as[0];
+        inline_decode(edit, &raw, &key); // Single bytes other than ESC decode without reading further input
+    }
+    if (key.type == KEY_UNKNOWN) return false;
+
+    return inline_addkeysequence(edit, seq + 1, key.type, key.c[0]);
+}
+
 /* **********************************************************************
  * Input loop
  * ********************************************************************** */
@@ -1810,15 +4562,12 @@ static bool inline_insert(inline_editor *edit, const char *bytes, size_t nbytes)
     if (edit->cursor_posn < edit->grapheme_count) offset = edit->graphemes[edit->cursor_posn];
     else offset = edit->buffer_len;
 
-    // Move contents after the insertion point to make room for the inserted text
-    memmove(edit->buffer + offset + nbytes, edit->buffer + offset, edit->buffer_len - offset);
-
+    inline_movegap(edit, offset); // Insert into the gap at the insertion point
     memcpy(edit->buffer + offset, bytes, nbytes); // Copy new text into buffer
     edit->buffer_len += nbytes;
-    edit->buffer[edit->buffer_len] = '\0'; // Ensure null-terminated
+    edit->gap_start += nbytes;
     
-    inline_recomputegraphemes(edit);
-    inline_recomputelines(edit);
+    inline_updategraphemes(edit, offset, 0, nbytes);
 
     // Move cursor to end of inserted text
     int newpos = inline_findgraphemeindex(edit, offset + nbytes);
@@ -1833,13 +4582,10 @@ static void inline_deletebytes(inline_editor *edit, size_t start, size_t end) {
     if (start >= end || end > edit->buffer_len) return;
 
     size_t bytes = end - start;
-    memmove(edit->buffer + start, edit->buffer + end, edit->buffer_len - end); // Move subsequent text
+    inline_movegap(edit, start); // Deleted bytes are absorbed into the gap
     edit->buffer_len -= bytes;
 
-    edit->buffer[edit->buffer_len] = '\0'; // Ensure null termination
-
-    inline_recomputegraphemes(edit);
-    inline_recomputelines(edit);
+    inline_updategraphemes(edit, start, bytes, 0);
     edit->refresh = true;
 }
 
@@ -1884,6 +4630,9 @@ static void inline_delete(inline_editor *edit) {
 /** Clear the buffer */
 static void inline_clear(inline_editor *edit) {
     edit->buffer_len = 0; // Clear text buffer
+    edit->gap_start = 0;
+    edit->multiline_offset = 0;
+    edit->multiline_state = 0;
     edit->buffer[0] = '\0';
     inline_recomputegraphemes(edit);
     inline_recomputelines(edit);
@@ -1896,7 +4645,7 @@ static void inline_clear(inline_editor *edit) {
 static void inline_navigatetolineboundary(inline_editor *edit, bool end) {
     int row;
     inline_cursorposn(edit, &row, NULL);
-    inline_setcursorposn(edit, inline_findgraphemeindex(edit, edit->lines[row + end]));
+    inline_setcursorposn(edit, edit->line_graphemes[row + end]);
 }
 
 static void inline_home(inline_editor *edit) {
@@ -1907,12 +4656,33 @@ static void inline_end(inline_editor *edit) {
     inline_navigatetolineboundary(edit, true);
 }
 
+/** Scroll by a page, keeping the cursor in the same column and at the same place in the
+ *  viewport; moves to the start or end of the buffer once there is no further page */
+static void inline_page(inline_editor *edit, int direction) {
+    int row, col;
+    inline_cursorposn(edit, &row, &col);
+
+    int page = edit->viewport.screen_rows;
+    int target = row + direction * page;
+    if (target < 0 || target >= edit->line_count) {
+        inline_setcursorposn(edit, (direction < 0 ? 0 : edit->grapheme_count));
+        return;
+    }
+
+    edit->viewport.first_visible_line += direction * page;
+    int start = edit->line_graphemes[target];
+    int end = edit->line_graphemes[target + 1];
+    if (target + 1 < edit->line_count) end--; // Stay before the newline that ends the line
+    inline_setcursorposn(edit, imin(start + col, end));
+    edit->refresh = true; // The viewport moved even if the cursor position did not
+}
+
 static void inline_pageup(inline_editor *edit) {
-    inline_setcursorposn(edit, 0);
+    inline_page(edit, -1);
 }
 
 static void inline_pagedown(inline_editor *edit) {
-    inline_setcursorposn(edit, edit->grapheme_count);
+    inline_page(edit, +1);
 }
 
 static void inline_left(inline_editor *edit) {
@@ -1938,7 +4708,7 @@ static void inline_clearselection(inline_editor *edit) {
 static void inline_copyselection(inline_editor *edit) {
     size_t start, end;
     if (inline_selectionrange(edit, NULL, NULL, &start, &end))
-        inline_copytoclipboard(edit, edit->buffer + start, end - start);
+        inline_copytoclipboard(edit, inline_text(edit) + start, end - start);
 }
 
 /** Cut selected text */
@@ -1955,10 +4725,10 @@ static void inline_cutline(inline_editor *edit, bool before) {
     size_t b_cursor = edit->graphemes[edit->cursor_posn]; // Cursor position
 
     size_t b_start = imin(b_line, b_cursor), b_end = imax(b_line, b_cursor);
-    if (!before && b_end>0 && edit->buffer[b_end-1]=='\n') b_end--; // Don't include newline
+    if (!before && b_end>0 && inline_textbyte(edit, b_end-1)=='\n') b_end--; // Don't include newline
     if (b_start==b_end) return; // Nothing to copy
 
-    inline_copytoclipboard(edit, edit->buffer + b_start, b_end - b_start);
+    inline_copytoclipboard(edit, inline_text(edit) + b_start, b_end - b_start);
     inline_deletebytes(edit, b_start, b_end);
     inline_setcursorposn(edit, inline_findgraphemeindex(edit, b_start)); // Cursor moves to start of deleted region
 }
@@ -1971,9 +4741,76 @@ static void inline_paste(inline_editor *edit) {
     }
 }
 
+/** Normalize line endings in pasted text in place, converting CR and CRLF to LF; returns the new length */
+static size_t inline_normalizepaste(char *text, size_t len) {
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\r') {
+            if (i + 1 < len && text[i+1] == '\n') i++; // CRLF
+            text[j++] = '\n';
+        } else text[j++] = text[i];
+    }
+    return j;
+}
+
+/** Insert a chunk of pasted text, replacing any selection */
+static bool inline_insertpaste(inline_editor *edit, char *text, size_t len) {
+    len = inline_normalizepaste(text, len);
+    if (!len) return true;
+    if (edit->selection_posn != INLINE_INVALID) inline_deleteselection(edit); // Replace selection
+    return inline_insert(edit, text, len);
+}
+
+/** Read a bracketed paste up to the terminating ESC[201~, inserting it as a single edit. inline_poll reads only
+ *  the input that has arrived, keeping the paste in edit->paste and resuming it on later calls. */
+static bool inline_bracketedpaste(inline_editor *edit) {
+    const size_t endlen = sizeof(TERM_PASTEEND) - 1;
+    if (!edit->paste) {
+        if (!(edit->paste = inline_alloc(edit, INLINE_DEFAULT_PASTE_SIZE))) return false;
+        edit->paste_size = INLINE_DEFAULT_PASTE_SIZE;
+        edit->paste_len = 0;
+    }
+
+    bool success = true;
+    rawinput_t raw;
+    for (;;) {
+        if (edit->polling && !inline_waitforinput(edit, 0)) return true; // Resume once more input arrives
+        if (!inline_readraw(edit, &raw)) break;
+
+        char *text = edit->paste;
+        size_t len = edit->paste_len;
+        if (len >= edit->paste_size) { // Grow the paste buffer
+            char *new = inline_realloc(edit, text, 2 * edit->paste_size);
+            if (new) { edit->paste = text = new; edit->paste_size *= 2; }
+            else if (len > endlen) { // Out of memory: insert what we have, keeping a possible partial terminator
+                if (!inline_insertpaste(edit, text, len - endlen)) { success = false; break; }
+                memmove(text, text + len - endlen, endlen);
+                len = endlen;
+            } else { success = false; break; }
+        }
+
+        text[len++] = (char) raw;
+        edit->paste_len = len;
+        if (raw == '~' && len >= endlen && memcmp(text + len - endlen, TERM_PASTEEND, endlen) == 0) {
+            edit->paste_len -= endlen; // Strip the terminator
+            break;
+        }
+    }
+
+    if (success) success = inline_insertpaste(edit, edit->paste, edit->paste_len);
+    inline_dealloc(edit, edit->paste);
+    edit->paste = NULL;
+    return success;
+}
+
 /** Process a history keypress */
 static void inline_historykey(inline_editor *edit, int delta) {
-    inline_advancehistory(edit, delta);
+    bool browsing = (edit->history.index != INLINE_INVALID || edit->prefix_browsing);
+    if (!browsing && edit->buffer_len > 0 && edit->history_prefix_search) { // Only browse entries that begin with the text typed
+        if (delta < 0 && inline_beginprefixbrowsing(edit)) inline_advanceprefix(edit, delta);
+    } else if (edit->prefix_browsing) inline_advanceprefix(edit, delta);
+    else inline_advancehistory(edit, delta);
+
     inline_setcursorposn(edit, edit->grapheme_count); // Move to end
     inline_clearselection(edit);
     inline_clearsuggestions(edit);
@@ -1990,16 +4827,17 @@ static void inline_transpose(inline_editor *edit) {
     inline_graphemerange(edit, b, &b_start, &b_end);
 
     size_t a_len = a_end - a_start, b_len = b_end - b_start; // Temporary buffer
-    char *tmp = malloc(a_len);
+    char *tmp = inline_alloc(edit, a_len);
     if (!tmp) return;
 
-    memcpy(tmp, edit->buffer + a_start, a_len); // Copy a into temporary buffer
-    memmove(edit->buffer + a_start, edit->buffer + b_start, b_len); // Copy b overwriting a
-    memcpy(edit->buffer + a_start + b_len, tmp, a_len); // Copy a from the temporary buffer
+    char *text = inline_text(edit);
+    memcpy(tmp, text + a_start, a_len); // Copy a into temporary buffer
+    memmove(text + a_start, text + b_start, b_len); // Copy b overwriting a
+    memcpy(text + a_start + b_len, tmp, a_len); // Copy a from the temporary buffer
 
-    free(tmp);
+    inline_dealloc(edit, tmp);
 
-    inline_recomputegraphemes(edit);
+    inline_updategraphemes(edit, a_start, a_len + b_len, a_len + b_len);
     if (cur < n) inline_setcursorposn(edit, edit->cursor_posn+1);
 }
 
@@ -2010,6 +4848,137 @@ static void inline_applysuggestion(inline_editor *edit) {
     inline_clearsuggestions(edit);
 }
 
+/* ----------------------------------------
+ * Incremental history search
+ * ---------------------------------------- */
+
+#define INLINE_SEARCH_PROMPT "(reverse-i-search)`%.*s': "
+#define INLINE_SEARCH_FAILED_PROMPT "(failed reverse-i-search)`%.*s': "
+
+/** Rebuild the search prompt to show the current query */
+static bool inline_updatesearchprompt(inline_editor *edit) {
+    const char *format = (edit->search_failed ? INLINE_SEARCH_FAILED_PROMPT : INLINE_SEARCH_PROMPT);
+    int qlen = (int) edit->search_len;
+    const char *q = (edit->search_query ? edit->search_query : "");
+
+    int n = snprintf(NULL, 0, format, qlen, q);
+    if (n < 0) return false;
+    char *p = inline_transientalloc(edit, (size_t) n + 1);
+    if (!p) return false;
+    snprintf(p, (size_t) n + 1, format, qlen, q);
+
+    edit->search_prompt = p;
+    edit->prompt_widths_valid = false;
+    inline_updateviewportwidth(edit);
+    edit->refresh = true;
+    return true;
+}
+
+/** Show a history entry, selecting the part that matches the query */
+static void inline_showsearchmatch(inline_editor *edit, int i, size_t offset) {
+    const inline_historyentry_t *e = inline_historyring_get(&edit->history, i);
+    inline_clearselection(edit);
+    inline_clear(edit);
+    if (!inline_insert(edit, e->text, e->len)) return;
+
+    edit->search_match = i;
+    edit->history.index = i; // Browsing continues from the match
+    edit->selection_posn = inline_findgraphemeindex(edit, offset);
+    inline_setcursorposn(edit, inline_findgraphemeindex(edit, offset + edit->search_len));
+}
+
+/** Search for the query in entries no newer than `from`, showing the match if one is found */
+static void inline_refinesearch(inline_editor *edit, int from) {
+    size_t offset;
+    int i = inline_searchhistory(edit, edit->search_query, edit->search_len, from, &offset);
+    edit->search_failed = (i == INLINE_INVALID && edit->search_len > 0);
+    if (i != INLINE_INVALID) inline_showsearchmatch(edit, i, offset);
+    inline_updatesearchprompt(edit);
+}
+
+/** Begin an incremental history search */
+static void inline_beginsearch(inline_editor *edit) {
+    char *saved = inline_transientstrdup(edit, inline_text(edit), edit->buffer_len);
+    if (!saved) return;
+
+    edit->search_saved = saved;
+    edit->search_saved_cursor = edit->cursor_posn;
+    edit->search_len = 0;
+    edit->search_match = INLINE_INVALID;
+    edit->search_failed = false;
+    edit->search_active = true;
+    inline_clearsuggestions(edit);
+    if (!inline_updatesearchprompt(edit)) edit->search_active = false;
+}
+
+/** End the search, keeping the entry shown or restoring the original contents of the buffer */
+static void inline_endsearch(inline_editor *edit, bool keep) {
+    if (!edit->search_active) return;
+    edit->search_active = false;
+    inline_clearselection(edit);
+
+    if (!keep || edit->search_match == INLINE_INVALID) {
+        inline_clear(edit);
+        inline_insert(edit, edit->search_saved, strlen(edit->search_saved));
+        inline_setcursorposn(edit, edit->search_saved_cursor);
+        edit->history.index = INLINE_INVALID;
+    }
+    edit->search_saved = NULL;
+
+    edit->prompt_widths_valid = false;
+    inline_updateviewportwidth(edit);
+    edit->refresh = true;
+}
+
+/** Append bytes to the search query */
+static bool inline_extendsearch(inline_editor *edit, const char *bytes, size_t n) {
+    if (edit->search_len + n > edit->search_size) {
+        size_t newsize = (edit->search_size ? edit->search_size : 32);
+        while (newsize < edit->search_len + n) newsize *= 2;
+        char *q = inline_realloc(edit, edit->search_query, newsize);
+        if (!q) return false;
+        edit->search_query = q;
+        edit->search_size = newsize;
+    }
+    memcpy(edit->search_query + edit->search_len, bytes, n);
+    edit->search_len += n;
+    return true;
+}
+
+/** Process a keypress during search; returns true if the key was consumed by the search */
+static bool inline_searchkeypress(inline_editor *edit, const keypress_t *key) {
+    int newest = edit->history.count - 1;
+    int current = (edit->search_match == INLINE_INVALID ? newest : edit->search_match);
+
+    switch (key->type) {
+        case KEY_CHARACTER: // Refine the query, which may still match the current entry
+            if (inline_extendsearch(edit, (const char *) key->c, (size_t) key->nbytes)) inline_refinesearch(edit, current);
+            return true;
+        case KEY_DELETE: // Shorten the query by a character and search again from the newest entry
+            if (edit->search_len == 0) return true;
+            do edit->search_len--;
+            while (edit->search_len > 0 && ((unsigned char) edit->search_query[edit->search_len] & 0xC0) == 0x80);
+            if (edit->search_len == 0) { // Nothing to match, so show the original buffer again
+                inline_endsearch(edit, false);
+                inline_beginsearch(edit);
+            } else inline_refinesearch(edit, newest);
+            return true;
+        case KEY_CTRL:
+            if (key->c[0] == 'R') { // Find an older match
+                if (edit->search_len > 0) inline_refinesearch(edit, current - 1);
+                return true;
+            } else if (key->c[0] == 'G') { // Cancel the search
+                inline_endsearch(edit, false);
+                return true;
+            }
+            break;
+        default: break;
+    }
+
+    inline_endsearch(edit, true); // Any other key accepts the entry shown and is then processed as usual
+    return false;
+}
+
 /** Handle Ctrl+_ shortcuts */
 static bool inline_processshortcut(inline_editor *edit, char c) {
     switch (c) {
@@ -2028,6 +4997,7 @@ static bool inline_processshortcut(inline_editor *edit, char c) {
         case 'N': inline_historykey(edit, 1); break; // Next history
         case 'O': inline_copyselection(edit); break;
         case 'P': inline_historykey(edit, -1); break; // Previous history
+        case 'R': inline_beginsearch(edit); break; // Reverse history search
         case 'T': inline_transpose(edit); break;
         case 'U': inline_cutline(edit, true); break; // Cut to start of line
         case 'X': inline_cutselection(edit); break;
@@ -2050,12 +5020,30 @@ static bool inline_processmeta(inline_editor *edit, const unsigned char *c, int
     return true;
 }
 
+/** Ask the multiline callback whether the buffer needs further lines; the incremental callback is shown only
+ *  the text added since it was last called, unless earlier text has changed in the meantime */
+static bool inline_needsmorelines(inline_editor *edit) {
+    if (!edit->multiline_fn && !edit->incremental_multiline_fn) return false;
+    INLINE_STAT(edit, multiline_calls);
+    if (edit->multiline_fn) return edit->multiline_fn(inline_text(edit), edit->multiline_ref);
+
+    size_t off = edit->multiline_offset;
+    if (edit->gap_start > off && edit->gap_start < edit->buffer_len) inline_movegap(edit, off); // Make the new text contiguous
+    uintptr_t state = edit->multiline_state;
+    bool more = edit->incremental_multiline_fn(inline_textptr(edit, off), edit->buffer_len - off, edit->multiline_ref, &state);
+    edit->multiline_offset = edit->buffer_len;
+    edit->multiline_state = state;
+    return more;
+}
+
 /** Process a keypress */
 static bool inline_processkeypress(inline_editor *edit, const keypress_t *key) {
+    if (edit->search_active && inline_searchkeypress(edit, key)) return true;
+
     bool generatesuggestions=true, clearselection=true, endbrowsing=true;
     switch (key->type) {
         case KEY_RETURN:
-            if (!edit->multiline_fn || !edit->multiline_fn(edit->buffer, edit->multiline_ref)) return false;
+            if (!inline_needsmorelines(edit)) return false;
         case KEY_CTRL_RETURN: // v fallthrough
             if (!inline_insert(edit, "\n", 1)) return false;
             generatesuggestions = false;  // newline shouldn't trigger suggestion
@@ -2084,6 +5072,10 @@ static bool inline_processkeypress(inline_editor *edit, const keypress_t *key) {
         case KEY_PAGE_UP:   inline_pageup(edit);     break;
         case KEY_PAGE_DOWN: inline_pagedown(edit);   break;
         case KEY_DELETE:    inline_delete(edit);     break;
+        case KEY_FORWARD_DELETE:
+            inline_clearselection(edit);
+            inline_deletecurrent(edit);
+            break;
         case KEY_TAB:
             if (inline_havesuggestions(edit)) {
                 inline_advancesuggestions(edit, 1);
@@ -2101,7 +5093,10 @@ static bool inline_processkeypress(inline_editor *edit, const keypress_t *key) {
         case KEY_CHARACTER:
             if (!inline_insert(edit, (char *) key->c, key->nbytes)) return false;
             break;
-        case KEY_UNKNOWN:   break;
+        case KEY_PASTE: // Pasted text is inserted verbatim, bypassing the multiline check
+            if (!inline_bracketedpaste(edit)) return false;
+            break;
+        default:            break; // Unbound keys, such as function keys or ESC, only end selection and browsing
     }
 
     if (clearselection) inline_clearselection(edit);
@@ -2115,65 +5110,185 @@ static bool inline_processkeypress(inline_editor *edit, const keypress_t *key) {
  * Interface
  * ********************************************************************** */
 
-/** If we're not attached to a terminal, e.g. a pipe, simply read the file in. */
-static void inline_noterminal(inline_editor *edit) {
-    int c;
+/** Refill the read-ahead buffer from stdin; returns false at end of input or on error */
+static bool inline_fillpipe(inline_editor *edit) {
+    if (!edit->pipe && !(edit->pipe = inline_alloc(edit, INLINE_PIPE_BUFFER_SIZE))) return false;
+    edit->pipe_pos = edit->pipe_len = 0;
+
+    int n;
+    do {
+        n = (int) INLINE_READ(STDIN_FILENO, edit->pipe, INLINE_PIPE_BUFFER_SIZE); // Returns whatever is available, e.g. one line from a pipe
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    edit->pipe_len = (size_t) n;
+    return true;
+}
+
+/** If we're not attached to a terminal, e.g. a pipe, read the next line in bulk, scanning
+ *  input read ahead in large chunks for the newline; returns false at end of input. */
+static bool inline_noterminal(inline_editor *edit) {
+    bool read_any = false;
 
-    while ((c = fgetc(stdin)) != EOF && c != '\n') {
-        if (!inline_extendbufferby(edit, 1)) break; // Buffer could not be extended
-        edit->buffer[edit->buffer_len++] = (char)c;
+    for (;;) {
+        if (edit->pipe_pos >= edit->pipe_len && !inline_fillpipe(edit)) break;
+        read_any = true;
+
+        const char *start = edit->pipe + edit->pipe_pos;
+        size_t avail = edit->pipe_len - edit->pipe_pos;
+        const char *nl = memchr(start, '\n', avail);
+        size_t n = (nl ? (size_t) (nl - start) : avail);
+
+        if (!inline_extendbufferby(edit, n)) break; // Buffer could not be extended
+        memcpy(edit->buffer + edit->buffer_len, start, n);
+        edit->buffer_len += n;
+        edit->gap_start = edit->buffer_len; // Keep the gap at the end
+        edit->pipe_pos += n + (nl ? 1 : 0);
+        if (nl) break;
     }
 
     edit->buffer[edit->buffer_len] = '\0'; // Ensure null termination
+    return read_any;
 }
 
-/** If the terminal is unsupported, display a prompt and read the line normally. */
-static void inline_unsupported(inline_editor *edit) {
+/** If the terminal is unsupported, display a prompt and read the line normally; returns false at end of input. */
+static bool inline_unsupported(inline_editor *edit) {
     fputs(edit->prompt, stdout);
     fflush(stdout);  // Ensure prompt appears
 
-    inline_noterminal(edit);
+    bool read_any = inline_noterminal(edit);
 
-    int length = (int)edit->buffer_len - 1; // Strip trailing control characters
-    while (length >= 0 && iscntrl((unsigned char)edit->buffer[length])) edit->buffer[length--] = '\0';
+    size_t length = edit->buffer_len; // Strip trailing control characters
+    while (length > 0 && iscntrl((unsigned char)edit->buffer[length - 1])) length--;
 
-    edit->buffer_len = length + 1;
+    edit->buffer[length] = '\0';
+    edit->buffer_len = length;
+    edit->gap_start = edit->buffer_len;
+    return read_any;
 }
 
-/** Normal interface if terminal recognized */
-static void inline_supported(inline_editor *edit) {
+/** Block until terminal input is available, meanwhile issuing asynchronous autocomplete
+ *  requests once their debounce interval elapses and displaying results as they are posted */
+static void inline_awaitinput(inline_editor *edit) {
+    if (!edit->complete_request_fn) return; // Reading blocks as usual
+
+    while (edit->input_pos >= edit->input_len) {
+        int timeout = -1;
+        if (edit->complete_request_pending) {
+            uint64_t now = inline_now();
+            timeout = (edit->complete_request_due > now ? (int) (edit->complete_request_due - now) : 0);
+        }
+
+        int events = inline_waitforevents(edit, timeout);
+        if (events < 0) return; // Leave the error to be reported by the read
+
+        if (events & INLINE_EVENT_WAKEUP) {
+            inline_drainwakeup(edit);
+            if (inline_collectsuggestions(edit)) {
+                inline_redraw(edit);
+                edit->last_frame_ms = inline_now();
+            }
+        }
+        if (events & INLINE_EVENT_INPUT) return;
+        if (!events && edit->complete_request_pending) inline_issuerequest(edit); // Debounce interval elapsed without input
+    }
+}
+
+/** Decide whether to redraw now: defer while input is queued, or while
+ *  input arrives before the frame rate limit permits another frame */
+static bool inline_framedue(inline_editor *edit) {
+    if (inline_inputpending(edit)) return false; // Process queued keypresses first
+    if (!edit->max_fps) return true;
+
+    uint64_t interval = 1000u / (uint64_t) edit->max_fps, elapsed = inline_now() - edit->last_frame_ms;
+    if (elapsed >= interval) return true;
+    return !inline_waitforinput(edit, (int) (interval - elapsed)); // Redraw once the interval elapses without input
+}
+
+/** Update terminal width and viewport if the terminal was resized */
+static void inline_checkresize(inline_editor *edit) {
+    if (!resize_pending) return;
+    inline_updateterminalwidth(edit);
+    inline_updateviewportwidth(edit);
+    edit->frame_valid = false; // Terminal contents may have reflowed
+    edit->refresh = true; // Ensure we redraw after resize
+    resize_pending = 0;
+}
+
+/** Enter raw mode and draw the empty editing window; returns false if raw mode could not be entered */
+static bool inline_beginsupported(inline_editor *edit) {
     inline_reset(edit);
     inline_setutf8();
-    if (!inline_enablerawmode(edit)) return;  // Could not enter raw mode
+    if (!inline_enablerawmode(edit)) return false;  // Could not enter raw mode
     inline_updateterminalwidth(edit);
     inline_initviewport(edit);
     inline_redraw(edit);
+    edit->last_frame_ms = inline_now();
+    return true;
+}
+
+/** Draw the final state of the line, leave raw mode and record the line in the history */
+static void inline_endsupported(inline_editor *edit) {
+    inline_endsearch(edit, true); // In case input ended during a search
+    inline_clearselection(edit);
+    inline_clearsuggestions(edit);
+    inline_setcursorposn(edit, edit->grapheme_count); // Finish below the last line of the entry
+    inline_redraw(edit);
+    inline_disablerawmode(edit);
+
+    if (edit->buffer_len > 0 && inline_addhistory(edit, inline_text(edit)) && edit->history_file) { // Add to history if non-empty
+        inline_appendhistoryfile(edit, edit->buffer, edit->buffer_len); // Shared with the history file too
+    }
+    INLINE_WRITE(STDOUT_FILENO, "\r\n", 2);
+}
+
+/** Normal interface if terminal recognized */
+static void inline_supported(inline_editor *edit) {
+    if (!inline_beginsupported(edit)) return;
 
     keypress_t key;
-    while (inline_readkeypress(edit, &key)) {
-        if (!inline_processkeypress(edit, &key)) break;
-
-        if (resize_pending) {
-            /* Update terminal width and viewport on resize */
-            inline_updateterminalwidth(edit);
-            inline_updateviewportwidth(edit);
-            edit->refresh = true; // Ensure we redraw after resize
-            resize_pending = 0;
-        }
-        
-        if (edit->refresh) {
+    for (;;) {
+        inline_awaitinput(edit);
+        if (!inline_readkeypress(edit, &key) || !inline_processkeypress(edit, &key)) break;
+        inline_checkresize(edit);
+
+        if (edit->refresh && inline_framedue(edit)) {
             inline_redraw(edit);
+            edit->last_frame_ms = inline_now();
             edit->refresh = false;
         }
     }
 
-    inline_clearselection(edit);
-    inline_clearsuggestions(edit);
-    inline_redraw(edit);
-    inline_disablerawmode(edit);
+    inline_endsupported(edit);
+}
+
+/** Release per-readline strings all at once once a line has been read */
+static void inline_finishreadline(inline_editor *edit) {
+    inline_dealloc(edit, edit->paste); // Abandoned while polling
+    edit->paste = NULL;
+    inline_stringlist_clear(edit, &edit->suggestions);
+    edit->search_saved = edit->search_prompt = edit->history_prefix = NULL;
+    inline_cleartransient(edit, true);
+}
+
+/** Read a line into the editor's buffer; returns false at the end of piped input or on error */
+static bool inline_readintobuffer(inline_editor *edit) {
+    inline_clear(edit);  // Reset buffer
+    inline_resetstats(edit);
+
+    bool more = true;
+    if (!inline_checktty()) more = inline_noterminal(edit);
+    else if (inline_checksupported()) inline_supported(edit);
+    else more = inline_unsupported(edit);
+
+    inline_finishreadline(edit);
+    return (more && edit->buffer != NULL);
+}
 
-    if (edit->buffer_len > 0) inline_addhistory(edit, edit->buffer); // Add to history if non-empty
-    write(STDOUT_FILENO, "\r\n", 2);
+/** Copy the editor's buffer for the caller */
+static char *inline_copyline(inline_editor *edit) {
+    char *line = malloc(edit->buffer_len + 1); // The caller frees the line, so it comes from malloc rather than the editor's allocator
+    if (line) memcpy(line, inline_text(edit), edit->buffer_len + 1);
+    return line;
 }
 
 /** API function to read a line of text from the user.
@@ -2181,12 +5296,136 @@ static void inline_supported(inline_editor *edit) {
  *  @returns a heap-allocated copy of the string input by the user (caller must free),
  *           or NULL on error. */
 char *inline_readline(inline_editor *edit) {
-    if (!edit) return NULL;
+    if (!edit || !inline_readintobuffer(edit)) return NULL;
+    return inline_copyline(edit);
+}
+
+/** API function to read a line of text from the user without copying it.
+ *  @param   edit - an inline_editor that has been created with inline_new.
+ *  @param   len  - if not NULL, set to the length of the line in bytes.
+ *  @returns the editor's own buffer, which remains valid until the editor is next used, or NULL on error. */
+const char *inline_readline_borrow(inline_editor *edit, size_t *len) {
+    if (!edit || !inline_readintobuffer(edit)) return NULL;
+
+    if (len) *len = edit->buffer_len;
+    return inline_text(edit);
+}
+
+/* ----------------------------------------
+ * Event loop interface
+ * ---------------------------------------- */
+
+/** API function to begin reading a line without blocking.
+ *  @param   edit - an inline_editor that has been created with inline_new.
+ *  @returns true if the editing window is shown; false if inline_readline should be used instead,
+ *           i.e. if input is not a supported terminal or a line is already being read. */
+bool inline_readline_begin(inline_editor *edit) {
+    if (!edit || edit->polling || !inline_checktty() || !inline_checksupported()) return false;
+
     inline_clear(edit);  // Reset buffer
+    inline_resetstats(edit);
+    if (!inline_beginsupported(edit)) {
+        inline_finishreadline(edit);
+        return false;
+    }
+    edit->polling = true;
+    edit->line_ready = false;
+    return true;
+}
 
-    if (!inline_checktty()) inline_noterminal(edit);
-    else if (inline_checksupported()) inline_supported(edit);
-    else inline_unsupported(edit);
+/** API function to obtain the file descriptor to watch for input while polling, or -1 on Windows */
+int inline_getfd(inline_editor *edit) {
+    (void) edit;
+#ifdef _WIN32
+    return -1; // Wait on GetStdHandle(STD_INPUT_HANDLE) instead
+#else
+    return STDIN_FILENO;
+#endif
+}
+
+/** API function to obtain the descriptor signaled when suggestions are posted, or -1 if there is none */
+int inline_getwakeupfd(inline_editor *edit) {
+#ifdef _WIN32
+    (void) edit;
+    return -1; // Wait on the handle from inline_getwakeupevent instead
+#else
+    return (edit && edit->complete_request_fn ? edit->wakeup[0] : -1);
+#endif
+}
+
+/** API function to obtain the event signaled when suggestions are posted on Windows, or NULL if there is none */
+void *inline_getwakeupevent(inline_editor *edit) {
+#ifdef _WIN32
+    return (edit && edit->complete_request_fn ? (void *) edit->wakeup : NULL);
+#else
+    (void) edit;
+    return NULL;
+#endif
+}
+
+/** API function to process any input that is ready without waiting for more.
+ *  @param   edit    - an inline_editor on which inline_readline_begin has been called.
+ *  @param   timeout - if not NULL, set to the number of ms after which inline_poll should be called again
+ *                     even if no input arrives, or -1 if it need only be called when input is ready.
+ *  @returns INLINE_POLL_READY once the line has been accepted, INLINE_POLL_PENDING if more input
+ *           is needed, or INLINE_POLL_ERROR if no line is being read. */
+int inline_poll(inline_editor *edit, int *timeout) {
+    if (timeout) *timeout = INLINE_INVALID;
+    if (!edit || !edit->polling) return INLINE_POLL_ERROR;
+    if (edit->line_ready) return INLINE_POLL_READY;
+
+    if (edit->complete_request_fn) { // Display posted suggestions and issue a request whose debounce interval has elapsed
+        inline_drainwakeup(edit);
+        if (inline_collectsuggestions(edit)) edit->refresh = true;
+        if (edit->complete_request_pending && inline_now() >= edit->complete_request_due) inline_issuerequest(edit);
+    }
+
+    keypress_t key;
+    while (edit->paste || inline_inputpending(edit)) { // Process every keypress already waiting, then redraw once
+        bool success = true;
+        if (edit->paste) { // Resume a paste that ran out of input
+            inline_keypressunknown(&key);
+            key.type = KEY_PASTE;
+        } else if ((success = inline_pollkeypress(edit, &key)) && edit->input_due) break; // Await the rest of a sequence
+
+        if (!success || !inline_processkeypress(edit, &key)) {
+            inline_endsupported(edit);
+            edit->line_ready = true;
+            return INLINE_POLL_READY;
+        }
+        if (edit->paste) break; // The rest of the paste has yet to arrive
+    }
+    inline_checkresize(edit);
+
+    if (edit->refresh) {
+        inline_redraw(edit);
+        edit->last_frame_ms = inline_now();
+        edit->refresh = false;
+    }
+
+    uint64_t due = (edit->complete_request_pending ? edit->complete_request_due : UINT64_MAX);
+    if (edit->input_due && edit->input_due < due) due = edit->input_due; // A held sequence is decoded as it stands
+    if (timeout && due != UINT64_MAX) {
+        uint64_t now = inline_now();
+        *timeout = (due > now ? (int) (due - now) : 0);
+    }
+    return INLINE_POLL_PENDING;
+}
+
+/** API function to finish reading a line begun with inline_readline_begin.
+ *  @param   edit - an inline_editor on which inline_readline_begin has been called.
+ *  @returns a heap-allocated copy of the line (caller must free) if inline_poll reported it ready;
+ *           otherwise the line is abandoned, the terminal restored, and NULL returned. */
+char *inline_readline_end(inline_editor *edit) {
+    if (!edit || !edit->polling) return NULL;
+
+    if (!edit->line_ready) { // Abandon the line, as for Ctrl+C
+        inline_clear(edit);
+        inline_endsupported(edit);
+    }
+    char *line = (edit->line_ready ? inline_copyline(edit) : NULL);
 
-    return (edit->buffer ? inline_strdup(edit->buffer) : NULL);
+    edit->polling = edit->line_ready = false;
+    inline_finishreadline(edit);
+    return line;
 }
@@ -17,6 +17,9 @@
 /* Forward declaration of the line editor structure */
 typedef struct inline_editor inline_editor;
 
+/* Forward declaration of a cache of grapheme results that editors may share */
+typedef struct inline_graphemecache inline_graphemecache;
+
 /* **********************************************************************
  * Callback functions
  * ********************************************************************** */
@@ -51,6 +54,17 @@ typedef struct inline_editor inline_editor;
  *        The editor copies the suggestion immediately. */
 typedef const char *(*inline_completefn) (const char *utf8, void *ref, size_t *index);
 
+/** @brief Asynchronous autocomplete request callback.
+ *  @details Called on the editor's thread once typing pauses for the
+ *           configured debounce interval. The callback should start work
+ *           (e.g. hand the text to a worker thread) and return promptly;
+ *           results are delivered later with inline_postsuggestions.
+ *
+ *  @param[in] utf8        Current buffer contents; valid only during the call, so copy it if needed.
+ *  @param[in] ref         User-supplied reference pointer.
+ *  @param[in] generation  Tag identifying this request; pass it back to inline_postsuggestions. */
+typedef void (*inline_completerequestfn) (const char *utf8, void *ref, uint64_t generation);
+
 /* -----------------------
  * Syntax coloring
  * ----------------------- */
@@ -72,6 +86,21 @@ typedef struct {
  *  @returns true if a span was found, false if no more spans exist. */
 typedef bool (*inline_syntaxcolorfn) (const char *utf8, void *ref, size_t offset, inline_colorspan_t *out);
 
+/** @brief Incremental syntax coloring callback, called repeatedly by the
+ *         editor to obtain the colored spans of a single line. The span is
+ *         assumed to begin at offset.
+ *  @param[in]     line    The line encoded as UTF-8, including any trailing newline; not null terminated.
+ *  @param[in]     len     Length of the line in bytes.
+ *  @param[in]     ref     User-supplied reference pointer.
+ *  @param[in]     offset  Byte offset within the line at which to begin scanning.
+ *  @param[in,out] state   Opaque lexer state. Holds the state at the end of the previous
+ *                         line (zero for the first line) on the first call for a line;
+ *                         the callback should update it as it scans.
+ *  @param[out]    out     Filled with the next colored span, if any; byte_end is relative to the start of the line.
+ *
+ *  @returns true if a span was found, false if no more spans exist; *state must then hold the state at the end of the line. */
+typedef bool (*inline_incrementalsyntaxcolorfn) (const char *line, size_t len, void *ref, size_t offset, uintptr_t *state, inline_colorspan_t *out);
+
 /* -----------------------
  * Multiline editing
  * ----------------------- */
@@ -86,6 +115,18 @@ typedef bool (*inline_syntaxcolorfn) (const char *utf8, void *ref, size_t offset
  *  @returns true if more lines are required, false otherwise. */
 typedef bool (*inline_multilinefn) (const char *utf8, void *ref);
 
+/** @brief Incremental multiline callback function
+ * Called, like inline_multilinefn, when inline wants to know whether it should enter multiline mode,
+ * but given only the text added to the buffer since the previous call.
+ *  @param[in]     utf8   Text added since the previous call, encoded as UTF-8; not null terminated.
+ *  @param[in]     len    Length of the text in bytes.
+ *  @param[in]     ref    User-supplied reference pointer.
+ *  @param[in,out] state  Opaque parser state. Holds the state left by the previous call, or zero if the text
+ *                        begins at the start of the buffer; the callback should update it as it scans.
+ *
+ *  @returns true if more lines are required, false otherwise. */
+typedef bool (*inline_incrementalmultilinefn) (const char *utf8, size_t len, void *ref, uintptr_t *state);
+
 /* -----------------------
  * Grapheme support
  * ----------------------- */
@@ -108,6 +149,28 @@ typedef size_t (*inline_graphemefn) (const char *in, const char *end);
  *           width. A fallback implementation is used if not provided. */
 typedef int (*inline_widthfn)(const char *g, size_t len);
 
+/* -----------------------
+ * Memory allocation
+ * ----------------------- */
+
+/** @brief Allocator callback; behaves like malloc
+ *  @param[in]  size       - number of bytes to allocate
+ *  @param[in]  ref        - user-supplied reference pointer
+ *  @returns a pointer to the allocated memory, or NULL on failure */
+typedef void *(*inline_allocfn) (size_t size, void *ref);
+
+/** @brief Reallocator callback; behaves like realloc, including when ptr is NULL
+ *  @param[in]  ptr        - memory previously allocated by the allocator, or NULL
+ *  @param[in]  size       - new size in bytes
+ *  @param[in]  ref        - user-supplied reference pointer
+ *  @returns a pointer to the resized memory, or NULL on failure, in which case ptr is unchanged */
+typedef void *(*inline_reallocfn) (void *ptr, size_t size, void *ref);
+
+/** @brief Deallocator callback; behaves like free, but is never passed NULL
+ *  @param[in]  ptr        - memory previously allocated by the allocator
+ *  @param[in]  ref        - user-supplied reference pointer */
+typedef void (*inline_freefn) (void *ptr, void *ref);
+
 /* **********************************************************************
  * Core API
  * ********************************************************************** */
@@ -121,30 +184,148 @@ inline_editor *inline_new(const char *prompt);
  *  @param[in] edit   Line editor to free. */
 void inline_free(inline_editor *edit);
 
+/** @brief Supply a custom allocator for the editor's storage.
+ *  @param[in] edit     Line editor to configure; must not yet have been configured or used.
+ *  @param[in] alloc    Allocator, or NULL to restore malloc.
+ *  @param[in] realloc  Reallocator, or NULL to restore realloc.
+ *  @param[in] free     Deallocator, or NULL to restore free.
+ *  @param[in] ref      User-supplied reference pointer passed to each callback.
+ *  @returns true on success; false if only some callbacks were supplied, the editor
+ *           was already configured, or allocation failed.
+ *  @note The editor structure itself and lines returned by inline_readline
+ *        are always allocated with malloc. The callbacks may also be called
+ *        from a thread calling inline_postsuggestions. */
+bool inline_setallocator(inline_editor *edit, inline_allocfn alloc, inline_reallocfn realloc, inline_freefn free, void *ref);
+
 /** @brief Read a line of input from the terminal.
  *  @param[in] edit   Line editor to use.
  *  @returns A heap allocated UTF-8 string containing the user's input, or NULL on EOF or error.
  *           Caller owns the string and must call it later using free(). */
 char *inline_readline(inline_editor *edit);
 
+/** @brief Read a line of input from the terminal without copying it.
+ *  @param[in]  edit   Line editor to use.
+ *  @param[out] len    If not NULL, set to the length of the input in bytes.
+ *  @returns The editor's internal buffer holding the NUL-terminated UTF-8 input,
+ *           or NULL on EOF or error. The buffer remains owned by the editor and
+ *           is valid until the editor is next used to read or display text, or is
+ *           freed; it must not be modified or freed by the caller. */
+const char *inline_readline_borrow(inline_editor *edit, size_t *len);
+
+/** Status codes returned by inline_poll */
+#define INLINE_POLL_ERROR   -1  /* No line is being read */
+#define INLINE_POLL_PENDING  0  /* More input is needed */
+#define INLINE_POLL_READY    1  /* The line has been accepted; call inline_readline_end */
+
+/** @brief Begin reading a line without blocking, for use from an event loop.
+ *  @details Shows the editing window and enters raw mode, which is kept until inline_readline_end.
+ *  @param[in] edit   Line editor to use.
+ *  @returns true on success; false if input is not a supported terminal, in which case
+ *           inline_readline should be used instead. */
+bool inline_readline_begin(inline_editor *edit);
+
+/** @brief Obtain the file descriptor to watch for terminal input while polling.
+ *  @param[in] edit   Line editor to use.
+ *  @returns The descriptor, or -1 on Windows, where the console input handle should be waited on instead. */
+int inline_getfd(inline_editor *edit);
+
+/** @brief Obtain the file descriptor to watch, alongside inline_getfd, for suggestions posted from other threads.
+ *  @details inline_poll should be called when it becomes readable; inline_poll consumes the signal.
+ *  @param[in] edit   Line editor to use, after inline_asyncautocomplete has been called.
+ *  @returns The descriptor, or -1 if asynchronous completion is not enabled or on Windows,
+ *           where the handle from inline_getwakeupevent should be waited on instead. */
+int inline_getwakeupfd(inline_editor *edit);
+
+/** @brief Obtain the event handle to wait on, alongside the console input handle, for suggestions posted
+ *         from other threads on Windows.
+ *  @param[in] edit   Line editor to use, after inline_asyncautocomplete has been called.
+ *  @returns The HANDLE of an auto-reset event, or NULL if asynchronous completion is not enabled or
+ *           on other platforms. */
+void *inline_getwakeupevent(inline_editor *edit);
+
+/** @brief Process any input that is ready, without waiting for more.
+ *  @details A partial escape sequence, UTF-8 character or bracketed paste is kept until later calls supply
+ *           the rest; an escape sequence still incomplete once the escape timeout elapses is decoded as it stands.
+ *  @param[in]  edit     Line editor on which inline_readline_begin has been called.
+ *  @param[out] timeout  If not NULL, set to the number of milliseconds after which inline_poll should be
+ *                       called again even without input, or -1 if it need only be called when input is ready.
+ *  @returns INLINE_POLL_READY, INLINE_POLL_PENDING or INLINE_POLL_ERROR. */
+int inline_poll(inline_editor *edit, int *timeout);
+
+/** @brief Finish reading a line begun with inline_readline_begin and leave raw mode.
+ *  @param[in] edit   Line editor to use.
+ *  @returns A heap allocated copy of the line if inline_poll returned INLINE_POLL_READY, which the caller
+ *           must free; otherwise the line is abandoned and NULL is returned. */
+char *inline_readline_end(inline_editor *edit);
+
+/** @brief Change the prompt.
+ *  @details May be called between calls to inline_readline, or from a callback while editing.
+ *  @param[in] edit     Line editor to configure.
+ *  @param[in] prompt   The new prompt string. This is immediately copied and you may free/modify upon return.
+ *  @returns true on success; false otherwise, in which case the previous prompt is retained. */
+bool inline_setprompt(inline_editor *edit, const char *prompt);
+
+/** @brief Sets the maximum number of autocomplete suggestions to gather.
+ *  @param[in] edit   Line editor to configure.
+ *  @param[in] max    Maximum number of suggestions; negative values mean unlimited */
+void inline_setmaxsuggestions(inline_editor *edit, int max);
+
 /** @brief Sets the maximum length of the history.
  *  @param[in] edit   Line editor to configure.
  *  @param[in] maxlen Maximum number of entries in the history buffer;
  *                    negative values mean unlimited; 0 disables history */
 void inline_sethistorylength(inline_editor *edit, int maxlen);
 
+/** @brief Chooses whether browsing the history after typing visits only entries that begin with the text typed.
+ *  @param[in] edit   Line editor to configure.
+ *  @param[in] enable true to browse only matching entries; false, the default, to browse every entry. */
+void inline_sethistoryprefixsearch(inline_editor *edit, bool enable);
+
 /** @brief Adds an entry to the history.
  *  @param[in] edit   Line editor to use.
  *  @param[in] entry  Entry to add. This is copied immediately and the pointer is not stored.
  *  @returns true if the entry was successfully added to the history list; false otherwise */
 bool inline_addhistory(inline_editor *edit, const char *entry);
 
+/** @brief Loads history entries from a file, appending them to the history.
+ *  @param[in] edit   Line editor to configure.
+ *  @param[in] path   File written by inline_savehistory or inline_sethistoryfile.
+ *  @returns true if the file was read; false otherwise
+ *  @note The file is memory-mapped and entries refer to it directly; it must not be
+ *        truncated while the editor is alive. */
+bool inline_loadhistory(inline_editor *edit, const char *path);
+
+/** @brief Saves the history to a file, replacing its contents.
+ *  @details The history is written to a new file alongside path, with a unique name formed by appending
+ *           a suffix to path, which is then renamed over path, so editors that loaded the previous file keep
+ *           their mapping of it. The new file is created readable only by its owner, or with the mode of the
+ *           file it replaces. If path is a symbolic link, the file it refers to is replaced; on Windows the
+ *           link itself is replaced by a regular file.
+ *  @param[in] edit   Line editor.
+ *  @param[in] path   File to write; may be a file the history was loaded from.
+ *  @returns true on success; false otherwise */
+bool inline_savehistory(inline_editor *edit, const char *path);
+
+/** @brief Sets a file to which each line accepted by inline_readline is appended.
+ *  @param[in] edit   Line editor to configure.
+ *  @param[in] path   File to append to, or NULL to disable; this is copied immediately.
+ *  @returns true on success; false otherwise */
+bool inline_sethistoryfile(inline_editor *edit, const char *path);
+
 /** @brief Enable syntax coloring.
  *  @param[in] edit   Line editor to configure.
  *  @param[in] fn     Syntax coloring callback.
  *  @param[in] ref    User-supplied reference pointer. */
 void inline_syntaxcolor(inline_editor *edit, inline_syntaxcolorfn fn, void *ref);
 
+/** @brief Enable incremental syntax coloring, replacing any callback set with inline_syntaxcolor.
+ *  @details Spans and end-of-line states are cached for each line; after an edit, lines are
+ *           re-lexed from the first changed line until the lexer state converges.
+ *  @param[in] edit   Line editor to configure.
+ *  @param[in] fn     Incremental syntax coloring callback.
+ *  @param[in] ref    User-supplied reference pointer. */
+void inline_incrementalsyntaxcolor(inline_editor *edit, inline_incrementalsyntaxcolorfn fn, void *ref);
+
 /** Macros for basic ANSI terminal colors */
 #define INLINE_BLACK        0
 #define INLINE_RED          1
@@ -185,12 +366,36 @@ void inline_syntaxcolor(inline_editor *edit, inline_syntaxcolorfn fn, void *ref)
  *  @returns: true on success; false otherwise */
 bool inline_setpalette(inline_editor *edit, int count, const int *palette);
 
+/** @brief Choose how colors and selection highlighting are switched off.
+ *  @details By default inline resets all attributes and reapplies any that remain;
+ *           when enabled, it resets only the foreground color or inverse video as needed,
+ *           which emits fewer bytes for heavily colored lines.
+ *  @param[in] edit     Line editor to configure.
+ *  @param[in] enable   true to reset only the attribute that changes. */
+void inline_setforegroundreset(inline_editor *edit, bool enable);
+
 /** @brief Enable autocomplete.
  *  @param[in] edit   Line editor to configure.
  *  @param[in] fn     Completion callback.
  *  @param[in] ref    User-supplied reference pointer. */
 void inline_autocomplete(inline_editor *edit, inline_completefn fn, void *ref);
 
+/** @brief Enable asynchronous autocomplete, replacing any synchronous callback.
+ *  @param[in] edit      Line editor to configure.
+ *  @param[in] fn        Request callback, or NULL to disable.
+ *  @param[in] ref       User-supplied reference pointer.
+ *  @param[in] debounce  Milliseconds without input before a request is issued.
+ *  @returns true on success; false otherwise */
+bool inline_asyncautocomplete(inline_editor *edit, inline_completerequestfn fn, void *ref, int debounce);
+
+/** @brief Deliver suggestions for an asynchronous request; safe to call from any thread.
+ *  @param[in] edit         Line editor.
+ *  @param[in] generation   Tag passed to the request callback.
+ *  @param[in] count        Number of suggestions.
+ *  @param[in] suggestions  Completion suffixes; these are copied immediately.
+ *  @returns true if accepted; false if the request is stale or memory ran out */
+bool inline_postsuggestions(inline_editor *edit, uint64_t generation, int count, const char * const *suggestions);
+
 /** @brief Enable multiline editing.
  *  @param[in] edit                 Line editor to configure.
  *  @param[in] fn                   Multiline callback.
@@ -199,6 +404,14 @@ void inline_autocomplete(inline_editor *edit, inline_completefn fn, void *ref);
  *  @returns true on success; false otherwise */
 bool inline_multiline(inline_editor *edit, inline_multilinefn fn, void *ref, const char *continuation_prompt);
 
+/** @brief Enable multiline editing with an incremental callback, replacing any callback set with inline_multiline.
+ *  @param[in] edit                 Line editor to configure.
+ *  @param[in] fn                   Incremental multiline callback.
+ *  @param[in] ref                  User-supplied reference pointer.
+ *  @param[in] continuation_prompt  Prompt to use for continuation lines; this is copied immediately and you may free/modify after.
+ *  @returns true on success; false otherwise */
+bool inline_incrementalmultiline(inline_editor *edit, inline_incrementalmultilinefn fn, void *ref, const char *continuation_prompt);
+
 /** @brief Supply a custom grapheme splitter.
  *  @param[in] edit                 Line editor to configure.
  *  @param[in] fn                   Grapheme callback. */
@@ -209,6 +422,48 @@ void inline_setgraphemesplitter(inline_editor *edit, inline_graphemefn fn);
  *  @param[in] fn                   Grapheme display width callback. */
 void inline_setgraphemewidth(inline_editor *edit, inline_widthfn fn);
 
+/** @brief Create a cache of the results of a custom grapheme splitter and width calculator for non-ASCII graphemes.
+ *  @details The cache may be shared by editors on any number of threads; lookups never wait for a lock.
+ *  @param[in] split                Splitter whose results are cached, or NULL to cache only widths.
+ *  @param[in] width                Width calculator whose results are cached, or NULL to cache only splits.
+ *  @param[in] entries              Approximate number of entries to hold; rounded up to a power of two.
+ *  @returns A newly allocated cache, or NULL on failure or if both callbacks are NULL. */
+inline_graphemecache *inline_newgraphemecache(inline_graphemefn split, inline_widthfn width, int entries);
+
+/** @brief Free a shared grapheme cache; no editor may still be using it.
+ *  @param[in] cache                Cache to free. */
+void inline_freegraphemecache(inline_graphemecache *cache);
+
+/** @brief Discard every entry in a shared grapheme cache, e.g. after the widths reported by its calculator change.
+ *  @param[in] cache                Cache to invalidate; may be called from any thread. */
+void inline_invalidategraphemecache(inline_graphemecache *cache);
+
+/** @brief Use a shared grapheme cache.
+ *  @details The cache is consulted only while the editor's splitter or width calculator is the one it was created for.
+ *  @param[in] edit                 Line editor to configure.
+ *  @param[in] cache                Cache to use, or NULL to stop using one. */
+void inline_setgraphemecache(inline_editor *edit, inline_graphemecache *cache);
+
+/** @brief Limit the rate at which the editing window is redrawn.
+ *  @details Keypresses that are already queued are always processed before a redraw;
+ *           this additionally spaces redraws at least 1/fps seconds apart.
+ *  @param[in] edit                 Line editor to configure.
+ *  @param[in] fps                  Maximum number of redraws per second; 0 removes the limit. */
+void inline_setmaxfps(inline_editor *edit, int fps);
+
+/** @brief Set how long to wait for the rest of an escape sequence.
+ *  @details If no further input arrives within this time after ESC, the ESC is treated as a keypress on its own.
+ *  @param[in] edit                 Line editor to configure.
+ *  @param[in] ms                   Timeout in milliseconds; negative waits indefinitely. */
+void inline_setescapetimeout(inline_editor *edit, int ms);
+
+/** @brief Recognize an additional escape sequence as an existing key.
+ *  @param[in] edit                 Line editor to configure.
+ *  @param[in] seq                  Sequence to recognize, beginning with ESC.
+ *  @param[in] as                   A sequence inline already recognizes, or a single ASCII character such as a control code.
+ *  @returns true if the sequence was registered; false otherwise. */
+bool inline_registerkeysequence(inline_editor *edit, const char *seq, const char *as);
+
 /* **********************************************************************
  * Terminal helpers
  * ********************************************************************** */
@@ -242,5 +497,53 @@ void inline_emitcolor(int color);
  *  @param[in] string   UTF-8 string to display.*/
 void inline_displaywithsyntaxcoloring(inline_editor *edit, const char *string);
 
+/** @brief Report the output generated by the most recent frame.
+ *  @details Each redraw is accumulated in an output buffer and written to the terminal at once.
+ *  @param[in]  edit     Line editor to query.
+ *  @param[out] bytes    Number of bytes written by the last frame; may be NULL.
+ *  @param[out] writes   Number of write calls made by the last frame; may be NULL. */
+void inline_getframestats(inline_editor *edit, size_t *bytes, int *writes);
+
+/* **********************************************************************
+ * Statistics
+ * ********************************************************************** */
+
+/** Counters for the line being read, gathered if inline is compiled with INLINE_ENABLE_STATS */
+typedef struct {
+    uint64_t keypresses;          // Keypresses read
+    uint64_t redraws;             // Frames drawn
+    uint64_t bytes_written;       // Bytes written to the terminal
+    uint64_t writes;              // Write calls made
+    uint64_t grapheme_recomputes; // Updates of the grapheme table, whole or incremental
+    uint64_t bytes_rescanned;     // Bytes split into graphemes by those updates
+    uint64_t syntax_calls;        // Calls to the syntax coloring callback
+    uint64_t complete_calls;      // Calls to the autocomplete callback, or requests issued to the asynchronous one
+    uint64_t multiline_calls;     // Calls to the multiline callback
+    uint64_t width_calls;         // Calls to the grapheme width function, built in or custom
+    uint64_t grapheme_calls;      // Calls to the grapheme splitter, built in or custom
+    uint64_t latency_count;       // Frames drawn in response to keypresses
+    uint64_t latency_total_ns;    // Total time from receiving a keypress to the end of the frame that showed it
+    uint64_t latency_max_ns;      // Longest such time
+} inline_stats_t;
+
+/** @brief Frame hook callback, called at the end of every redraw.
+ *  @param[in] edit     Line editor that drew the frame; the hook must not call inline_readline or modify it.
+ *  @param[in] stats    Counters for the line being read, or NULL if inline was compiled without INLINE_ENABLE_STATS.
+ *  @param[in] ref      User-supplied reference pointer. */
+typedef void (*inline_framefn) (inline_editor *edit, const inline_stats_t *stats, void *ref);
+
+/** @brief Obtain the counters for the line being read, or for the line last read once inline_readline returns.
+ *  @details The counters are reset as each line begins.
+ *  @param[in]  edit     Line editor to query.
+ *  @param[out] stats    Filled out with the counters; zeroed if they are unavailable.
+ *  @returns true on success; false if inline was compiled without INLINE_ENABLE_STATS. */
+bool inline_getstats(inline_editor *edit, inline_stats_t *stats);
+
+/** @brief Install a hook called at the end of every redraw, e.g. to export statistics to a tracing system.
+ *  @param[in] edit     Line editor to configure.
+ *  @param[in] fn       Hook, or NULL to remove it.
+ *  @param[in] ref      User-supplied reference pointer passed to the hook. */
+void inline_setframehook(inline_editor *edit, inline_framefn fn, void *ref);
+
 #endif /* INLINE_H */
 